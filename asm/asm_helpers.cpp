@@ -7,8 +7,29 @@ uint32_t IrInterpreter::getRefArrayOffset() {
     return 8*(1 + numCalleeSaved);
 }
 
+uint32_t IrInterpreter::cellValueOffset() {
+    // where a global's cell keeps its value, from one we make up front
+    static ValWrapper probe;
+    return (char*) &probe.ptr - (char*) &probe;
+}
+
+uint32_t IrInterpreter::kindOffset() {
+    // where a heap value keeps its kind, the same for every Value
+    static ValWrapper probe;
+    Value* value = &probe;
+    return (char*) &value->kind - (char*) value;
+}
+
+uint32_t IrInterpreter::closureFuncOffset() {
+    static Closure probe(nullptr, 0);
+    return (char*) &probe.func - (char*) &probe;
+}
+
 uint32_t IrInterpreter::getTempOffset(tempptr_t temp) {
-    return 8*(1 + numCalleeSaved + 1 + temp->index);
+    // temps that didn't get a register share the stack slots they were
+    // given by the register allocator
+    assert (temp->stackOffset);
+    return 8*(1 + numCalleeSaved + 1 + temp->stackOffset.value());
 }
 
 /************************
@@ -36,20 +57,37 @@ void IrInterpreter::callHelper(void* fn, vector<x64asm::Imm64> args, vector<temp
     assert (totalArgs <= numArgRegs);
 
     // IMPORTANT: the reg in lastArg should not be r10, rax, or any of the 6 argRegs
-    // STEP 1: save caller-saved registers to stack, reverse order
+    // STEP 1: save caller-saved registers to stack, reverse order, so rax
+    // comes first. only the ones holding live temps need it
+    vector<x64asm::R64> saved;
     for (int i = 0; i < numCallerSaved; ++i) {
-        Push(callerSavedRegs[numCallerSaved -1 - i]);
+        x64asm::R64 reg = callerSavedRegs[numCallerSaved -1 - i];
+        if (saveAllRegs || find(savedRegs.begin(), savedRegs.end(), reg) != savedRegs.end()) {
+            saved.push_back(reg);
+            Push(reg);
+        }
     }
+    bool savedRax = !saved.empty() && saved.front() == x64asm::rax;
 
+    // with only one arg in a reg, nothing else can overwrite it before
+    // it's moved into place, so it can skip the stack
+    int inRegs = count_if(temps.begin(), temps.end(),
+        [](tempptr_t t) { return (bool) t->reg; });
+    bool direct = !lastArg && inRegs == 1;
     int pushed = 0;
     // push the opt reg and the arg temps if they're in regs
     if (lastArg) {
          pushed += 1;
          Push(lastArg.value());
     }
-    for (auto it = temps.rbegin(); it != temps.rend(); it++) {
-        tempptr_t t = *it;
-        if (t->reg) {
+    for (int i = temps.size() - 1; i >= 0; i--) {
+        tempptr_t t = temps[i];
+        if (t->reg && direct) {
+            x64asm::R64 regToStore = callerSavedRegs[args.size() + i];
+            if (regToStore != t->reg.value()) {
+                assm.mov(regToStore, t->reg.value());
+            }
+        } else if (t->reg) {
             pushed += 1;
             Push(t->reg.value());
         }
@@ -73,9 +111,11 @@ void IrInterpreter::callHelper(void* fn, vector<x64asm::Imm64> args, vector<temp
         x64asm::R64 regToStore = callerSavedRegs[argIndex];
         // load differently depending on where the arg is
         if (tempToPush->reg) {
-            // can pop it 
-            Pop(regToStore);
-            pushed -=1;
+            // can pop it, unless it was moved there directly
+            if (!direct) {
+                Pop(regToStore);
+                pushed -=1;
+            }
         } else { // the value is stored on the stack; move from mem
             // move to the right reg from mem
             moveTemp(regToStore, tempToPush);
@@ -90,28 +130,41 @@ void IrInterpreter::callHelper(void* fn, vector<x64asm::Imm64> args, vector<temp
 
     assert(pushed==0);
 
+    // the frame is laid out so that rsp is 16-byte aligned when nothing has
+    // been pushed; pad the stack if an odd number of pushes are outstanding,
+    // since helpers (and libstdc++) rely on an aligned stack at the call
+    bool padded = (popCount % 2) != 0;
+    if (padded) {
+        assm.sub(x64asm::rsp, x64asm::Imm32{8});
+    }
     assm.mov(x64asm::r10, x64asm::Imm64{fn});
     assm.call(x64asm::r10);
+    if (padded) {
+        assm.add(x64asm::rsp, x64asm::Imm32{8});
+    }
 
     // assume we do not have args to pop from the stack
 
     // restore caller-saved registers from stack, minus rax
-    for (uint32_t i = 0; i < numCallerSaved - 1; ++i) {
-        Pop(callerSavedRegs[i]);
+    for (int i = saved.size() - 1; i >= (savedRax ? 1 : 0); i--) {
+        Pop(saved[i]);
     }
 
     // save return value
+    bool usesRax = false;
     if (returnTemp) {
         // move from rax to the temp
-        bool usesRax = (returnTemp.value()->reg) && (returnTemp.value()->reg.value() == x64asm::rax);
+        usesRax = (returnTemp.value()->reg) && (returnTemp.value()->reg.value() == x64asm::rax);
         if (!usesRax) {
             moveTemp(returnTemp.value(), x64asm::rax);
-            Pop(x64asm::rax);
-        } else { // if it does use rax, nothing to do!
+        }
+    }
+    if (savedRax) {
+        if (usesRax) { // if it does use rax, nothing to restore!
             Pop();
+        } else {
+            Pop(x64asm::rax);
         }
-    } else {
-        Pop(x64asm::rax);
     }
 }
 
@@ -126,71 +179,16 @@ void IrInterpreter::installLocalVar(tempptr_t temp, uint32_t localIdx) {
         // move directly to the reg
         assm.mov(temp->reg.value(), src);
     } else {
-        // the arg is stored on the stack; use rdi as scratch space
-        Push(x64asm::rdi);
-        // move the value into rdi
-        assm.mov(x64asm::rdi, src);
-        // move rdi onto the right stack location
-        moveTemp(temp, x64asm::rdi);
-        // restore rdi
-        Pop(x64asm::rdi);
+        // the arg is stored on the stack; go through the scratch reg
+        x64asm::R64 reg = getScratchReg();
+        assm.mov(reg, src);
+        moveTemp(temp, reg);
+        returnScratchReg(reg);
     }
 }
 
 void IrInterpreter::installLocalNone(tempptr_t temp) {
-    x64asm::Imm64 src = x64asm::Imm64{(uint64_t)vmPointer->NONE};
-    if (temp->reg) {
-        assm.mov(temp->reg.value(), src);
-    } else {
-        // put None in a scratch reg
-        Push(x64asm::rdi);
-        assm.mov(x64asm::rdi, src);
-        moveTemp(temp, x64asm::rdi);
-        Pop(x64asm::rdi);
-    }
-}
-
-void IrInterpreter::installLocalRefVar(tempptr_t temp, uint32_t localIdx) {
-    x64asm::R64 reg = x64asm::rdi;
-    bool usedScratch = false;
-    if (temp->reg) {
-        reg = temp->reg.value();
-    } else {
-        // use rdi as scratch space
-        Push(reg);
-        usedScratch = true;
-    }
-    // move the value to the target reg if applicable else a scratch reg
-    assm.mov(
-         reg,
-         x64asm::M64{x64asm::rdi, x64asm::Imm32{8*localIdx}}
-    );
-    // convert to a valwrapper
-    vector<tempptr_t> noTempArgs;
-    vector<x64asm::Imm64> args = {
-        x64asm::Imm64{vmPointer},
-    };
-    tempptr_t returnTemp = temp;
-    // this will put the result back inside the right temp
-    callHelper((void*) &(helper_new_valwrapper), args, noTempArgs, reg, returnTemp);
-
-    // cleanup
-    if (usedScratch) {
-        // restore rdi
-        Pop(reg);
-    }
-}
-
-void IrInterpreter::installLocalRefNone(tempptr_t temp) {
-    // convert to ValWrapper
-    vector<tempptr_t> noTempArgs;
-    vector<x64asm::Imm64> args = {
-        x64asm::Imm64{vmPointer},
-        x64asm::Imm64{(uint64_t)vmPointer->NONE},
-    };
-    tempptr_t returnTemp = temp;
-    // this will put the result back inside the right temp
-    callHelper((void*) &(helper_new_valwrapper), args, noTempArgs, returnTemp);
+    moveImm(temp, (uint64_t)vmPointer->NONE);
 }
 
 /************************
@@ -198,15 +196,15 @@ void IrInterpreter::installLocalRefNone(tempptr_t temp) {
  ***********************/
 
 x64asm::R64 IrInterpreter::getScratchReg() {
-    x64asm::R64 toSpill = x64asm::r10;
-    Push(toSpill);
+    // r10 is never given to a temp, so it can be used without saving it;
+    // there's only the one, so uses can't nest
+    assert (regPopCount == 0);
     regPopCount += 1; // metadata to check for errors
-    LOG("getting scratch reg: " + asmRegToString(toSpill));
-    return toSpill;
+    LOG("getting scratch reg: " + asmRegToString(x64asm::r10));
+    return x64asm::r10;
 };
 
 void IrInterpreter::returnScratchReg(x64asm::R64 reg) {
-    Pop(reg);
     regPopCount -= 1;
 }
 
@@ -223,20 +221,62 @@ void IrInterpreter::moveTemp(tempptr_t dest, tempptr_t src) {
 
 void IrInterpreter::moveTemp(tempptr_t dest, x64asm::R64 src) {
     if (dest->reg) {
-        assm.mov(dest->reg.value(), src);
+        if (dest->reg.value() != src) {
+            assm.mov(dest->reg.value(), src);
+        }
     } else {
         // dest in mem, src is a reg
-        uint32_t destOffset = getTempOffset(dest);
-        assm.mov(
-            x64asm::M64{
-                x64asm::rbp,
-                x64asm::Imm32{-destOffset}
-            },
-            src
-        );
+        storeSlot(getTempOffset(dest), src);
     }
 }
 
+void IrInterpreter::moveImm(tempptr_t dest, uint64_t value) {
+    // most tagged ints and bools fit in a sign-extended imm32, which can
+    // go straight to the stack without a scratch reg
+    bool fits32 = (int64_t) value == (int32_t) value;
+    if (dest->reg) {
+        if (fits32) {
+            assm.assemble({x64asm::MOV_R64_IMM32,
+                {dest->reg.value(), x64asm::Imm32{(uint32_t) value}}});
+        } else {
+            assm.mov(dest->reg.value(), x64asm::Imm64{value});
+        }
+    } else if (fits32) {
+        uint32_t offset = getTempOffset(dest);
+        assm.assemble({x64asm::MOV_M64_IMM32, {
+            x64asm::M64{x64asm::rbp, x64asm::Imm32{-offset}},
+            x64asm::Imm32{(uint32_t) value}
+        }});
+    } else {
+        x64asm::R64 reg = getScratchReg();
+        assm.mov(reg, x64asm::Imm64{value});
+        moveTemp(dest, reg);
+        returnScratchReg(reg);
+    }
+}
+
+void IrInterpreter::bindLabel(string label) {
+    assm.bind(x64asm::Label{label});
+    lastLabelAt = asmFunc.size();
+}
+
+void IrInterpreter::loadSlot(x64asm::R64 dest, uint32_t offset) {
+    bool justStored = lastStoreEnd == asmFunc.size() &&
+        lastLabelAt != lastStoreEnd && lastStoreOffset == offset;
+    if (!justStored) {
+        assm.mov(dest, x64asm::M64{x64asm::rbp, x64asm::Imm32{-offset}});
+    } else if (lastStoreReg != dest) {
+        assm.mov(dest, lastStoreReg);
+    }
+}
+
+void IrInterpreter::storeSlot(uint32_t offset, x64asm::R64 src) {
+    assm.mov(x64asm::M64{x64asm::rbp, x64asm::Imm32{-offset}}, src);
+    lastStoreEnd = asmFunc.size();
+    lastStoreOffset = offset;
+    lastStoreReg = src;
+}
+
 //void IrInterpreter::moveTemp(tempptr_t dest, x64asm::Imm32 src, TempOp tempOp) {
 //    x64asm::Opcode op;
 //    if (src->reg) {
@@ -279,6 +319,9 @@ void IrInterpreter::moveTemp(x64asm::R64 dest, tempptr_t src, TempOp tempOp) {
             case TempOp::MOVE:
                 op = x64asm::MOV_R64_R64;
                 break;
+            case TempOp::ADD:
+                op = x64asm::ADD_R64_R64;
+                break;
             case TempOp::SUB:
                 op = x64asm::SUB_R64_R64;
                 break;
@@ -295,13 +338,23 @@ void IrInterpreter::moveTemp(x64asm::R64 dest, tempptr_t src, TempOp tempOp) {
                 op = x64asm::OR_R64_R64;
                 break;
         }
+        if (tempOp == TempOp::MOVE && dest == src->reg.value()) {
+            return;
+        }
         assm.assemble({op, {dest, src->reg.value()}});
     } else {
         uint32_t offset = getTempOffset(src);
+        if (tempOp == TempOp::MOVE) {
+            loadSlot(dest, offset);
+            return;
+        }
         switch (tempOp) {
             case TempOp::MOVE:
                 op = x64asm::MOV_R64_M64;
                 break;
+            case TempOp::ADD:
+                op = x64asm::ADD_R64_M64;
+                break;
             case TempOp::SUB:
                 op = x64asm::SUB_R64_M64;
                 break;
@@ -337,6 +390,9 @@ void IrInterpreter::moveTemp(tempptr_t dest, tempptr_t src, TempOp tempOp) {
             case TempOp::MOVE:
                 op = x64asm::MOV_M64_R64;
                 break;
+            case TempOp::ADD:
+                op = x64asm::ADD_M64_R64;
+                break;
             case TempOp::SUB:
                 op = x64asm::SUB_M64_R64;
                 break;
@@ -369,16 +425,14 @@ void IrInterpreter::moveTemp(tempptr_t dest, tempptr_t src, TempOp tempOp) {
             // we need a scratch reg
             x64asm::R64 reg = getScratchReg();
             // move src into the reg
-            uint32_t srcOffset = getTempOffset(src);
-            assm.mov(
-                reg,
-                x64asm::M64{
-                    x64asm::rbp,
-                    x64asm::Imm32{-srcOffset}
-                }
-            );
+            loadSlot(reg, getTempOffset(src));
             // move the reg into dest
             uint32_t destOffset = getTempOffset(dest);
+            if (tempOp == TempOp::MOVE) {
+                storeSlot(destOffset, reg);
+                returnScratchReg(reg);
+                return;
+            }
             assm.assemble({op, {
                 x64asm::M64{
                     x64asm::rbp,
@@ -419,6 +473,9 @@ void IrInterpreter::moveTemp(x64asm::R32 dest, tempptr_t src, TempOp tempOp) {
             case TempOp::MOVE:
                 op = x64asm::MOV_R32_R32;
                 break;
+            case TempOp::ADD:
+                op = x64asm::ADD_R32_R32;
+                break;
             case TempOp::SUB:
                 op = x64asm::SUB_R32_R32;
                 break;
@@ -442,6 +499,9 @@ void IrInterpreter::moveTemp(x64asm::R32 dest, tempptr_t src, TempOp tempOp) {
             case TempOp::MOVE:
                 op = x64asm::MOV_R32_M32;
                 break;
+            case TempOp::ADD:
+                op = x64asm::ADD_R32_M32;
+                break;
             case TempOp::SUB:
                 op = x64asm::SUB_R32_M32;
                 break;
@@ -481,6 +541,9 @@ void IrInterpreter::moveTemp32(tempptr_t dest, tempptr_t src, TempOp tempOp) {
             case TempOp::MOVE:
                 op = x64asm::MOV_M32_R32;
                 break;
+            case TempOp::ADD:
+                op = x64asm::ADD_M32_R32;
+                break;
             case TempOp::SUB:
                 op = x64asm::SUB_M32_R32;
                 break;
@@ -2,12 +2,12 @@
 // this needs to be here to break a circular dependency loop
 #include "../vm/interpreter.h"
 
-void helper_store_global(Interpreter* interpreter, string* name, tagptr_t ptr) {
-    interpreter->storeGlobal(*name, ptr);
+void helper_store_global(Interpreter* interpreter, uint64_t slot, tagptr_t ptr) {
+    interpreter->storeGlobal(slot, ptr);
 }
 
-tagptr_t helper_load_global(Interpreter* interpreter, string* name) {
-    return interpreter->loadGlobal(*name);
+tagptr_t helper_load_global(Interpreter* interpreter, uint64_t slot) {
+    return interpreter->loadGlobal(slot);
 }
 
 void helper_store_local_ref(tagptr_t ptr, tagptr_t ref) {
@@ -26,22 +26,17 @@ tagptr_t helper_eq(Interpreter* interpreter, tagptr_t left, tagptr_t right) {
 }
 
 tagptr_t helper_alloc_closure(Interpreter* interpreter, int numRefs, tagptr_t func_ptr, tagptr_t* refs) {
+    interpreter->collect();
     Function* func = cast_val<Function>(func_ptr);
-    vector<ValWrapper*> refVec;
-    for (int i = 0; i < numRefs; i++) {
-        ValWrapper* ref = cast_val<ValWrapper>(refs[i]);
-        refVec.push_back(ref); // these should be in order just like that
-    }
-    return make_ptr(interpreter->collector->allocate(refVec, func));
+    Closure* closure = interpreter->collector->allocate(func, numRefs);
+    // these should be in order just like that
+    copy(refs, refs + numRefs, closure->refs());
+    return make_ptr(closure);
 }
 
 tagptr_t helper_call(Interpreter* interpreter, int numArgs, tagptr_t clos_ptr, tagptr_t* args) {
-    // package this stuff into the right format and call back the vm 
-    vector<tagptr_t> argVec;
-    for (int i = 0; i < numArgs; i++) {
-        argVec.push_back(args[i]);
-    }
-    return interpreter->call(argVec, clos_ptr);
+    // the args stay on the compiled caller's stack for the whole call
+    return interpreter->call(numArgs, args, clos_ptr);
 }
 
 void helper_gc(Interpreter* interpreter) {
@@ -96,10 +91,12 @@ tagptr_t helper_unbox_valwrapper(tagptr_t val_ptr) {
 }
 
 tagptr_t helper_new_record(Interpreter* interpreter) {
+    interpreter->collect();
     return interpreter->collector->allocate<Record>();
 }
 
 tagptr_t helper_new_valwrapper(Interpreter* interpreter, tagptr_t ptr) {
+    interpreter->collect();
     return make_ptr(interpreter->collector->allocate<ValWrapper>(ptr));
 }
 
@@ -116,6 +113,21 @@ tagptr_t helper_get_record_field(Interpreter* interpreter, string* field, tagptr
 	return record->get(*field);
 }
 
+tagptr_t helper_get_record_field_unchecked(Interpreter* interpreter, string* field, tagptr_t record_ptr) {
+    // for loads hoisted out of a loop ahead of the record check, which
+    // still throws before the value is used
+    if (is_tagged(record_ptr) || dynamic_cast<Record*>(get_val(record_ptr)) == NULL) {
+        return interpreter->NONE;
+    }
+    return helper_get_record_field(interpreter, field, record_ptr);
+}
+
+tagptr_t helper_get_closure_ref(Interpreter* interpreter, uint64_t index, tagptr_t closure_ptr) {
+    // only reached below the check for the inlined closure, so the ref is
+    // there
+    return cast_val<Closure>(closure_ptr)->refs()[index];
+}
+
 tagptr_t helper_set_record_field(Interpreter* interpreter, string* field, tagptr_t record_ptr, tagptr_t ptr) {
     Record* record = cast_val<Record>(record_ptr);
 	record->set(*field, ptr, *interpreter->collector);
@@ -137,6 +149,6 @@ tagptr_t helper_set_record_index(Interpreter* interpreter, tagptr_t index, tagpt
 	return record_ptr;
 }
 
-void helper_type_exception() {
-    throw IllegalCastException("cannot cast to type");
+tagptr_t helper_deopt(Interpreter* interpreter, DeoptPoint* point, tagptr_t* values, tagptr_t* refs) {
+    return interpreter->deoptimize(point, values, refs);
 }
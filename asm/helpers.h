@@ -7,10 +7,11 @@
 #include "../opt/opt_tag_ptr.h"
 
 class Interpreter;
+struct DeoptPoint;
 
-void helper_store_global(Interpreter* interpreter, string* name, tagptr_t ptr);
+void helper_store_global(Interpreter* interpreter, uint64_t slot, tagptr_t ptr);
 
-tagptr_t helper_load_global(Interpreter* interpreter, string* name);
+tagptr_t helper_load_global(Interpreter* interpreter, uint64_t slot);
 
 void helper_store_local_ref(tagptr_t ptr, tagptr_t ref);
 
@@ -43,8 +44,10 @@ tagptr_t helper_new_valwrapper(Interpreter* interpreter, tagptr_t ptr);
 tagptr_t helper_cast_string(Interpreter* interpreter, tagptr_t ptr);
 
 tagptr_t helper_get_record_field(Interpreter* interpreter, string* field, tagptr_t record_ptr);
+tagptr_t helper_get_record_field_unchecked(Interpreter* interpreter, string* field, tagptr_t record_ptr);
+tagptr_t helper_get_closure_ref(Interpreter* interpreter, uint64_t index, tagptr_t closure_ptr);
 tagptr_t helper_set_record_field(Interpreter* interpreter, string* field, tagptr_t record_ptr, tagptr_t ptr);
 tagptr_t helper_get_record_index(Interpreter* interpreter, tagptr_t index, tagptr_t record_ptr);
 tagptr_t helper_set_record_index(Interpreter* interpreter, tagptr_t index, tagptr_t record_ptr, tagptr_t ptr);
 
-void helper_type_exception();
+tagptr_t helper_deopt(Interpreter* interpreter, DeoptPoint* point, tagptr_t* values, tagptr_t* refs);
@@ -1,9 +1,8 @@
 #include "ir_to_asm.h"
 
-IrInterpreter::IrInterpreter(IrFunc* irFunction, Interpreter* vmInterpreterPointer, vector<bool> isLocalRefVec) {
+IrInterpreter::IrInterpreter(IrFunc* irFunction, Interpreter* vmInterpreterPointer) {
     vmPointer = vmInterpreterPointer;
     func = irFunction;
-    isLocalRef = isLocalRefVec;
     // by convention, the first ir function is the main function
     instructionIndex = 0;
     finished = false;
@@ -31,6 +30,9 @@ void IrInterpreter::comparisonSetup(instptr_t inst, TempBoolOp tempBoolOp) {
             case TempBoolOp::CMOVNL:
                 op = x64asm::CMOVNL_R64_R64;
                 break;
+            case TempBoolOp::CMOVE:
+                op = x64asm::CMOVE_R64_R64;
+                break;
         }
         // put 1 in the scratch reg
         assm.mov(reg, x64asm::Imm64{1});
@@ -47,6 +49,9 @@ void IrInterpreter::comparisonSetup(instptr_t inst, TempBoolOp tempBoolOp) {
             case TempBoolOp::CMOVNL:
                 op = x64asm::CMOVNL_R64_M64;
                 break;
+            case TempBoolOp::CMOVE:
+                op = x64asm::CMOVE_R64_M64;
+                break;
         }
         // move 0 into the scratch reg
         assm.mov(reg, x64asm::Imm64{0});
@@ -69,6 +74,72 @@ void IrInterpreter::comparisonSetup(instptr_t inst, TempBoolOp tempBoolOp) {
     returnScratchReg(reg);
 };
 
+void IrInterpreter::checkTag(tempptr_t temp, uint32_t tag, string label) {
+    x64asm::R64 reg = getScratchReg();
+    moveTemp(reg, temp);
+    assm.and_(reg, x64asm::Imm32{ALL_TAG});
+    assm.cmp(reg, x64asm::Imm32{tag});
+    returnScratchReg(reg);
+    assm.jne_1(x64asm::Label{label});
+}
+
+void IrInterpreter::checkKind(tempptr_t temp, ValueKind kind, string label) {
+    string doneStr = KIND_CHECK_LABEL + to_string(instructionIndex);
+    x64asm::R64 reg = getScratchReg();
+    moveTemp(reg, temp);
+    // tagged values aren't on the heap
+    assm.assemble({x64asm::TEST_R64_IMM32, {reg, x64asm::Imm32{ALL_TAG}}});
+    assm.jne_1(x64asm::Label{doneStr});
+    assm.cmp(x64asm::M8{reg, x64asm::Imm32{kindOffset()}}, x64asm::Imm8{(uint8_t) kind});
+    bindLabel(doneStr);
+    returnScratchReg(reg);
+    assm.jne_1(x64asm::Label{label});
+}
+
+void IrInterpreter::assertKind(tempptr_t temp, ValueKind kind, void* helper) {
+    int slowPath = addSlowPath([this, temp, helper]() {
+        callHelper(helper, {}, {temp}, nullopt);
+    });
+    checkKind(temp, kind, SLOW_PATH_LABEL + to_string(slowPath));
+    bindLabel(SLOW_PATH_DONE_LABEL + to_string(slowPath));
+}
+
+void IrInterpreter::assertTag(tempptr_t temp, uint32_t tag, void* helper) {
+    int slowPath = addSlowPath([this, temp, helper]() {
+        callHelper(helper, {}, {temp}, nullopt);
+    });
+    checkTag(temp, tag, SLOW_PATH_LABEL + to_string(slowPath));
+    bindLabel(SLOW_PATH_DONE_LABEL + to_string(slowPath));
+}
+
+int IrInterpreter::addSlowPath(function<void()> emit) {
+    // the slow path runs with nothing pushed and the scratch reg free, so
+    // only jump to it between scratch reg uses. it saves the same regs
+    // around helper calls as the instruction it belongs to
+    vector<x64asm::R64> live = savedRegs;
+    slowPaths.push_back([this, emit, live]() {
+        savedRegs = live;
+        saveAllRegs = false;
+        emit();
+    });
+    return slowPaths.size() - 1;
+}
+
+void IrInterpreter::computeLiveRegs() {
+    liveCallerSaved.assign(func->instructions.size(), vector<x64asm::R64>());
+    set<x64asm::R64> callerSaved(callerSavedRegs, callerSavedRegs + numCallerSaved);
+    for (tempptr_t t : func->temps) {
+        if (!t->reg || callerSaved.count(t->reg.value()) == 0) {
+            continue;
+        }
+        for (pair<int, int>& range : t->ranges) {
+            for (int pos = max(range.first, 0); pos <= range.second; pos++) {
+                liveCallerSaved.at(pos).push_back(t->reg.value());
+            }
+        }
+    }
+}
+
 /************************
  * SETUP/TEARDOWN
  ***********************/
@@ -86,7 +157,12 @@ void IrInterpreter::prolog() {
     // allocate space for locals, refs, and temps on the stack
     // by decrementing rsp
     // and note that we are only storing on ref pointer by pushing the pointer to the array
-    spaceToAllocate = 8*(1 + func->temps.size()); // locals are temps now
+    spaceToAllocate = 8*(1 + func->temp_count); // spill slots of the temps
+    // return address, rbp and the callee-saved regs take up 56 bytes, so
+    // keep rsp 16-byte aligned once the locals are allocated
+    if (spaceToAllocate % 16 == 0) {
+        spaceToAllocate += 8;
+    }
     assm.sub(x64asm::rsp, x64asm::Imm32{spaceToAllocate});
 
     // put a pointer to the references onto the stack
@@ -115,29 +191,20 @@ void IrInterpreter::prolog() {
             // else, we are safe to move the reg into its arg
         }
 
-        if (isLocalRef.at(i)) {
-            installLocalRefVar(localTemp, i);
-        } else {
-            installLocalVar(localTemp, i);
-        }
+        installLocalVar(localTemp, i);
     }
     // now do rdi, if applicable
     if (rdiTemp >= 0) {
-        if (isLocalRef.at(rdiTemp)) {
-            installLocalRefVar(func->temps.at(rdiTemp), rdiTemp);
-        } else {
-            installLocalVar(func->temps.at(rdiTemp), rdiTemp);
-        }
+        installLocalVar(func->temps.at(rdiTemp), rdiTemp);
     }
 
     // set all other locals to none
     for (uint64_t i = func->parameter_count_; i < func->local_count_; i++) {
         tempptr_t localTemp = func->temps.at(i);
-        if (isLocalRef.at(i)) {
-            installLocalRefNone(localTemp);
-        } else {
-            installLocalNone(localTemp);
+        if (localTemp->startInterval == -1 && localTemp->endInterval == -1) {
+            continue;  // never used, and given nowhere to live
         }
+        installLocalNone(localTemp);
     }
 }
 
@@ -164,22 +231,52 @@ void IrInterpreter::epilog() {
 x64asm::Function IrInterpreter::run() {
     // start the assembler on the function
     assm.start(asmFunc);
-    asmFunc.reserve(func->instructions.size() * 100); // TODO: figure out how to allocate the right amount of memory
+    // TODO: figure out how to allocate the right amount of memory
+    // instructions with a slow path emit roughly twice as much code, and
+    // each deopt stub pushes the values its point keeps
+    size_t deoptSize = 0;
+    for (DeoptPoint* point : func->deoptPoints) {
+        deoptSize += 16 * (point->locals.size() + point->stack.size() +
+                point->refs.size()) + 100;
+    }
+    asmFunc.reserve(func->instructions.size() * 200 + deoptSize);
     prolog();
 
     if (func->instructions.size() > 0) {
         // translate to asm
+        computeLiveRegs();
+        saveAllRegs = false;
         while (!finished) {
             executeStep();
         }
+        saveAllRegs = true;
     }
 
     assm.mov(x64asm::R64{x64asm::rax}, x64asm::Imm64{(uint64_t)vmPointer->NONE});
     epilog();
-    // add exception throwing after returning None
-    assm.bind(x64asm::Label{TYPE_ERROR_LABEL});
-    callHelper((void*) helper_type_exception, {}, {}, nullopt);
-    epilog();
+    // the rest is cold: errors, deopts and slow paths only reached by
+    // jumps out of the body, so the body's common cases fall through
+    // failed guards leave through these; points whose guards were
+    // optimized away don't need one
+    set<int> guarded;
+    for (instptr_t inst : func->instructions) {
+        if (inst->op == IrOp::GuardInteger) {
+            guarded.insert(inst->op0.value());
+        }
+    }
+    for (int i : guarded) {
+        deoptStub(i);
+    }
+    bindLabel(DIV_ZERO_LABEL);
+    // we may get here with registers still pushed; this never returns, so
+    // just realign the stack for the helper
+    assm.and_(x64asm::rsp, x64asm::Imm8{0xf0});
+    callHelper((void*) helper_assert_nonzero, {0}, {}, nullopt);
+    for (int i = 0; i < slowPaths.size(); i++) {
+        bindLabel(SLOW_PATH_LABEL + to_string(i));
+        slowPaths.at(i)();
+        assm.jmp_1(x64asm::Label{SLOW_PATH_DONE_LABEL + to_string(i)});
+    }
 
     // finish compiling
     assm.finish();
@@ -188,11 +285,57 @@ x64asm::Function IrInterpreter::run() {
 }
 
 
+void IrInterpreter::deoptStub(int pointIndex) {
+    // hands the rest of the call over to the vm. the locals, operand stack
+    // and captured locals' ref temps are pushed to form an array for
+    // helper_deopt, and whatever
+    // the vm returns is returned from this function. we never jump back into
+    // the compiled code, so any register can be clobbered here
+    DeoptPoint* point = func->deoptPoints.at(pointIndex);
+    bindLabel(DEOPT_LABEL + to_string(pointIndex));
+    x64asm::R64 reg = x64asm::r10;
+    vector<tempptr_t> values = point->locals;
+    values.insert(values.end(), point->stack.begin(), point->stack.end());
+    values.insert(values.end(), point->refs.begin(), point->refs.end());
+    // push in reverse order, so the first local is lowest
+    for (int i = values.size() - 1; i >= 0; i--) {
+        tempptr_t t = values.at(i);
+        if (t->reg) {
+            Push(t->reg.value());
+        } else {
+            moveTemp(reg, t);
+            Push(reg);
+        }
+    }
+    uint32_t refArrayOffset = getRefArrayOffset();
+    assm.mov(x64asm::rdi, x64asm::Imm64{vmPointer});
+    assm.mov(x64asm::rsi, x64asm::Imm64{point});
+    assm.mov(x64asm::rdx, x64asm::rsp);
+    assm.mov(x64asm::rcx, x64asm::M64{x64asm::rbp, x64asm::Imm32{-refArrayOffset}});
+    assm.and_(x64asm::rsp, x64asm::Imm8{0xf0});
+    assm.mov(reg, x64asm::Imm64{(void*) &(helper_deopt)});
+    assm.call(reg);
+    // the result is in rax; put rsp back where the epilog expects it
+    assm.mov(x64asm::rsp, x64asm::rbp);
+    assm.sub(x64asm::rsp, x64asm::Imm32{8*numCalleeSaved + spaceToAllocate});
+    popCount = 0;
+    epilog();
+}
+
 /************************
  * MAIN EXECUTION
  ***********************/
 void IrInterpreter::executeStep() {
     instptr_t inst = func->instructions.at(instructionIndex);
+    // a helper call only has to keep what lives on after it; the result
+    // is written once the saved regs are back
+    savedRegs.clear();
+    opttemp_t def = irDef(inst);
+    for (x64asm::R64 reg : liveCallerSaved.at(instructionIndex)) {
+        if (!def || !def.value()->reg || def.value()->reg.value() != reg) {
+            savedRegs.push_back(reg);
+        }
+    }
     switch(inst->op) {
         case IrOp::LoadConst:
             {
@@ -200,18 +343,7 @@ void IrInterpreter::executeStep() {
                 int constIndex = inst->op0.value();
                 tagptr_t c = func->constants_.at(constIndex);
                 tempptr_t t = inst->tempIndices->at(0);
-                if (t->reg) {
-                    assm.mov(t->reg.value(), x64asm::Imm64{(uint64_t)c});
-                } else {
-                    // get a scratch reg to store this
-                    x64asm::R64 reg = getScratchReg();
-                    // move the val into the scratch reg
-                    assm.mov(reg, x64asm::Imm64{(uint64_t)c});
-                    // get the offset of the temp on the stack
-                    moveTemp(t, reg);
-                    // give back the scratch reg
-                    returnScratchReg(reg);
-                }
+                moveImm(t, (uint64_t)c);
                 break;
             }
         case IrOp::LoadFunc:
@@ -220,30 +352,28 @@ void IrInterpreter::executeStep() {
                 int funcIndex = inst->op0.value();
                 Function* f = func->functions_.at(funcIndex);
                 tempptr_t t = inst->tempIndices->at(0);
-                if (t->reg) {
-                    assm.mov(t->reg.value(), x64asm::Imm64{(uint64_t)f});
-                } else {
-                    // get a scratch reg to store this
-                    x64asm::R64 reg = getScratchReg();
-                    // move the val into the scratch reg
-                    assm.mov(reg, x64asm::Imm64{(uint64_t)f});
-                    // get the offset of the temp on the stack
-                    uint32_t offset = getTempOffset(t);
-                    // this moves the val at reg into the right rbp offset
-                    moveTemp(t, reg);
-                    // give back the scratch reg
-                    returnScratchReg(reg);
-                }
+                moveImm(t, (uint64_t)f);
                 break;
             }
        case IrOp::LoadGlobal:
             {
                 LOG(to_string(instructionIndex) + ": LoadGlobal");
-                string* name = &inst->name0.value();
-                vector<x64asm::Imm64> args = {vmPointer, name};
-                vector<tempptr_t> temps;
+                // globals are read straight out of their cells, which never
+                // move; only an undefined one goes to the vm, which throws
+                uint64_t slot = vmPointer->globalSlots.at(inst->name0.value());
                 tempptr_t returnTemp = inst->tempIndices->at(0);
-                callHelper((void *) &(helper_load_global), args, temps, returnTemp);
+                int slowPath = addSlowPath([this, slot, returnTemp]() {
+                    vector<x64asm::Imm64> args = {vmPointer, slot};
+                    callHelper((void *) &(helper_load_global), args, {}, returnTemp);
+                });
+                x64asm::R64 reg = getScratchReg();
+                assm.mov(reg, x64asm::Imm64{(uint64_t) vmPointer->globalCells[slot]});
+                assm.mov(reg, x64asm::M64{reg, x64asm::Imm32{cellValueOffset()}});
+                assm.test(reg, reg);
+                assm.je_1(x64asm::Label{SLOW_PATH_LABEL + to_string(slowPath)});
+                moveTemp(returnTemp, reg);
+                returnScratchReg(reg);
+                bindLabel(SLOW_PATH_DONE_LABEL + to_string(slowPath));
                 break;
             }
         case IrOp::StoreLocal:
@@ -257,10 +387,28 @@ void IrInterpreter::executeStep() {
        case IrOp::StoreGlobal:
             {
                 LOG(to_string(instructionIndex) + ": StoreGlobal");
-                string* name = &inst->name0.value();
-                vector<x64asm::Imm64> args = {vmPointer, name};
-                vector<tempptr_t> temps = {inst->tempIndices->at(0)};
-                callHelper((void *) &(helper_store_global), args, temps, nullopt);
+                // a global some compiled code reads as a constant is stored
+                // by the vm, which throws that code away
+                uint64_t slot = vmPointer->globalSlots.at(inst->name0.value());
+                tempptr_t val = inst->tempIndices->at(0);
+                vector<x64asm::Imm64> args = {vmPointer, slot};
+                if (!val->reg) {
+                    // the scratch reg holds the cell, so a spilled value
+                    // would need a second one; let the vm store it
+                    callHelper((void *) &(helper_store_global), args, {val}, nullopt);
+                    break;
+                }
+                int slowPath = addSlowPath([this, args, val]() {
+                    callHelper((void *) &(helper_store_global), args, {val}, nullopt);
+                });
+                x64asm::R64 reg = getScratchReg();
+                assm.mov(reg, x64asm::Imm64{(uint64_t) &vmPointer->watchedGlobals[slot]});
+                assm.cmp(x64asm::M8{reg}, x64asm::Imm8{0});
+                assm.jne_1(x64asm::Label{SLOW_PATH_LABEL + to_string(slowPath)});
+                assm.mov(reg, x64asm::Imm64{(uint64_t) vmPointer->globalCells[slot]});
+                assm.mov(x64asm::M64{reg, x64asm::Imm32{cellValueOffset()}}, val->reg.value());
+                returnScratchReg(reg);
+                bindLabel(SLOW_PATH_DONE_LABEL + to_string(slowPath));
                 break;
             }
         case IrOp::StoreLocalRef:
@@ -270,8 +418,43 @@ void IrInterpreter::executeStep() {
                     inst->tempIndices->at(1), // value to store
                     inst->tempIndices->at(0) // local valwrapper
                 };
-                tempptr_t returnTemp = inst->tempIndices->at(1);
-                callHelper((void *) &(helper_store_local_ref), {}, temps, returnTemp);
+                // a local no closure has captured yet has no valwrapper to
+                // update; the local's own temp already holds the value
+                int slowPath = addSlowPath([this, temps]() {
+                    // helper_store_local_ref returns nothing, so don't write
+                    // rax over the value
+                    callHelper((void *) &(helper_store_local_ref), {}, temps, nullopt);
+                });
+                x64asm::R64 reg = getScratchReg();
+                moveTemp(reg, inst->tempIndices->at(0));
+                assm.test(reg, reg);
+                returnScratchReg(reg);
+                assm.jne_1(x64asm::Label{SLOW_PATH_LABEL + to_string(slowPath)});
+                bindLabel(SLOW_PATH_DONE_LABEL + to_string(slowPath));
+                break;
+            }
+        case IrOp::LazyLocalRef:
+            {
+                LOG(to_string(instructionIndex) + ": LazyLocalRef");
+                // boxed by the first BoxLocalRef that runs
+                moveImm(inst->tempIndices->at(0), NULL_PTR);
+                break;
+            }
+        case IrOp::BoxLocalRef:
+            {
+                LOG(to_string(instructionIndex) + ": BoxLocalRef");
+                tempptr_t ref = inst->tempIndices->at(0);
+                tempptr_t val = inst->tempIndices->at(1);
+                // only the first closure to capture the local allocates
+                int slowPath = addSlowPath([this, ref, val]() {
+                    callHelper((void *) &(helper_new_valwrapper), {vmPointer}, {val}, ref);
+                });
+                x64asm::R64 reg = getScratchReg();
+                moveTemp(reg, ref);
+                assm.test(reg, reg);
+                returnScratchReg(reg);
+                assm.je_1(x64asm::Label{SLOW_PATH_LABEL + to_string(slowPath)});
+                bindLabel(SLOW_PATH_DONE_LABEL + to_string(slowPath));
                 break;
             }
        case IrOp::PushFreeRef:
@@ -297,6 +480,19 @@ void IrInterpreter::executeStep() {
                 returnScratchReg(reg);
                 break;
             }
+        case IrOp::PushClosureRef:
+            {
+                LOG(to_string(instructionIndex) + ": PushClosureRef");
+                vector<x64asm::Imm64> args = {
+                    x64asm::Imm64{(uint64_t) vmPointer},
+                    x64asm::Imm64{(uint64_t) inst->op0.value()}
+                };
+                vector<tempptr_t> temps = {
+                    inst->tempIndices->at(1)
+                };
+                callHelper((void *) &(helper_get_closure_ref), args, temps, inst->tempIndices->at(0));
+                break;
+            }
         case IrOp::LoadReference:
             {
                 LOG(to_string(instructionIndex) + ": LoadReference");
@@ -324,7 +520,11 @@ void IrInterpreter::executeStep() {
                     inst->tempIndices->at(1),
                 };
                 tempptr_t returnTemp = inst->tempIndices->at(0);
-                callHelper((void *) &(helper_get_record_field), args, temps, returnTemp);
+                if (inst->op0) {
+                    callHelper((void *) &(helper_get_record_field_unchecked), args, temps, returnTemp);
+                } else {
+                    callHelper((void *) &(helper_get_record_field), args, temps, returnTemp);
+                }
                 break;
             };
         case IrOp::FieldStore:
@@ -471,14 +671,47 @@ void IrInterpreter::executeStep() {
         case IrOp::Add:
             {
                 LOG(to_string(instructionIndex) + ": Add");
-                // call a helper to do add
-                vector<x64asm::Imm64> args = {vmPointer};
-                vector<tempptr_t> temps = {
-                    inst->tempIndices->at(2),
-                    inst->tempIndices->at(1)
-                };
-                tempptr_t returnTemp = inst->tempIndices->at(0);
-                callHelper((void *) &(helper_add), args, temps, returnTemp);
+                auto left = inst->tempIndices->at(2);
+                auto right = inst->tempIndices->at(1);
+                auto res = inst->tempIndices->at(0);
+                // anything but two ints goes to a helper
+                int slowPath = addSlowPath([this, left, right, res]() {
+                    vector<x64asm::Imm64> args = {vmPointer};
+                    vector<tempptr_t> temps = {left, right};
+                    callHelper((void *) &(helper_add), args, temps, res);
+                });
+                string slowLabel = SLOW_PATH_LABEL + to_string(slowPath);
+                checkTag(left, INT_TAG, slowLabel);
+                checkTag(right, INT_TAG, slowLabel);
+                // add the tagged values directly; the tags add up to two
+                // INT_TAGs, so take one away. the vm keeps ints shifted into
+                // 32 bits, so they wrap at 30; keeping the low 32 bits of the
+                // tagged sum wraps it the same way
+                x64asm::R64 reg = getScratchReg();
+                moveTemp(reg, left);
+                moveTemp(reg, right, TempOp::ADD);
+                assm.sub(reg, x64asm::Imm32{INT_TAG});
+                assm.movsxd(reg, getRegBottomHalf(reg));
+                moveTemp(res, reg);
+                returnScratchReg(reg);
+                bindLabel(SLOW_PATH_DONE_LABEL + to_string(slowPath));
+                break;
+            };
+        case IrOp::AddInteger:
+            {
+                LOG(to_string(instructionIndex) + ": AddInteger");
+                auto left = inst->tempIndices->at(2);
+                auto right = inst->tempIndices->at(1);
+                auto res = inst->tempIndices->at(0);
+                x64asm::R64 reg = getScratchReg();
+                moveTemp(reg, left);
+                moveTemp(reg, right, TempOp::ADD);
+                // the vm keeps ints shifted into 32 bits, so they wrap at 30;
+                // sign-extend the sum from there
+                assm.assemble({x64asm::SHL_R64_IMM8, {reg, x64asm::Imm8{32 + SHIFT}}});
+                assm.assemble({x64asm::SAR_R64_IMM8, {reg, x64asm::Imm8{32 + SHIFT}}});
+                moveTemp(res, reg);
+                returnScratchReg(reg);
                 break;
             };
         case IrOp::Sub:
@@ -526,10 +759,10 @@ void IrInterpreter::executeStep() {
                 Push(x64asm::rdx);
                 x64asm::R64 divisor = getScratchReg();
                 moveTemp(divisor, inst->tempIndices->at(1));
-                vector<tempptr_t> temps = {
-                    inst->tempIndices->at(1),
-                };
-                callHelper((void *) &(helper_assert_nonzero), {}, temps, nullopt);
+                // check for zero inline; helper_assert_nonzero only runs
+                // to throw
+                assm.cmp(getRegBottomHalf(divisor), x64asm::Imm32{0});
+                assm.je_1(x64asm::Label{DIV_ZERO_LABEL});
                 x64asm::R64 numerator_secondhalf = x64asm::rax;
                 moveTemp(numerator_secondhalf, inst->tempIndices->at(2));
                 assm.cdq(); // weird asm thing to sign-extend eax into edx
@@ -539,12 +772,14 @@ void IrInterpreter::executeStep() {
                 moveTemp(inst->tempIndices->at(0), x64asm::rax);
                 returnScratchReg(divisor);
                 // restore rax and rdx
-				if (inst->tempIndices->at(0)->reg.value() == x64asm::rdx) {
+                // (unless the result lives in one of them)
+                optreg_t resultReg = inst->tempIndices->at(0)->reg;
+				if (resultReg && resultReg.value() == x64asm::rdx) {
 					Pop();
 				} else {
                 	Pop(x64asm::rdx);
 				}
-				if (inst->tempIndices->at(0)->reg.value() == x64asm::rax) {
+				if (resultReg && resultReg.value() == x64asm::rax) {
 					Pop();
 				} else {
                 	Pop(x64asm::rax);
@@ -582,17 +817,47 @@ void IrInterpreter::executeStep() {
                 comparisonSetup(inst, TempBoolOp::CMOVNL);
                 break;
             };
+        case IrOp::EqInteger:
+            {
+                LOG(to_string(instructionIndex) + ": EqInteger");
+                comparisonSetup(inst, TempBoolOp::CMOVE);
+                break;
+            };
         case IrOp::Eq:
             {
                 LOG(to_string(instructionIndex) + ": Eq");
-                // call a helper to do equality
-                vector<x64asm::Imm64> args = {vmPointer};
-                vector<tempptr_t> temps = {
-                    inst->tempIndices->at(2),
-                    inst->tempIndices->at(1)
-                };
-                tempptr_t returnTemp = inst->tempIndices->at(0);
-                callHelper((void *) &(helper_eq), args, temps, returnTemp);
+                auto left = inst->tempIndices->at(2);
+                auto right = inst->tempIndices->at(1);
+                auto res = inst->tempIndices->at(0);
+                // strings and heap values need a helper
+                int slowPath = addSlowPath([this, left, right, res]() {
+                    vector<x64asm::Imm64> args = {vmPointer};
+                    vector<tempptr_t> temps = {left, right};
+                    callHelper((void *) &(helper_eq), args, temps, res);
+                });
+                // an int or bool is only equal to the exact same tagged
+                // value, whatever right is. those tags are 1 and 2, so
+                // tag - 1 is at most 1 exactly when left is one of them
+                x64asm::R64 reg = getScratchReg();
+                moveTemp(reg, left);
+                assm.and_(reg, x64asm::Imm32{ALL_TAG});
+                assm.sub(reg, x64asm::Imm32{INT_TAG});
+                assm.cmp(reg, x64asm::Imm32{BOOL_TAG - INT_TAG});
+                returnScratchReg(reg);
+                assm.ja_1(x64asm::Label{SLOW_PATH_LABEL + to_string(slowPath)});
+                // build the tagged bool from the comparison
+                reg = getScratchReg();
+                moveTemp(reg, left);
+                moveTemp(reg, right, TempOp::CMP);
+                // sete needs the scratch reg's low byte
+                assert(reg == x64asm::r10);
+                assm.sete(x64asm::r10b);
+                assm.and_(reg, x64asm::Imm32{1});
+                assm.shl(reg, x64asm::Imm8{SHIFT});
+                assm.or_(reg, x64asm::Imm32{BOOL_TAG});
+                moveTemp(res, reg);
+                returnScratchReg(reg);
+                bindLabel(SLOW_PATH_DONE_LABEL + to_string(slowPath));
                 break;
             };
         case IrOp::And:
@@ -662,85 +927,106 @@ void IrInterpreter::executeStep() {
                 assm.je_1(x64asm::Label{labelStr});
                 break;
             };
+        case IrOp::IfGt:
+            {
+                LOG(to_string(instructionIndex) + ": IfGt");
+                string labelStr = to_string(inst->op0.value());
+                // tagged ints compare the same way as the ints themselves.
+                // every int op wraps at 30 bits like the vm's, so both the
+                // tagged and the raw values fit in the low 32 bits
+                moveTemp32(inst->tempIndices->at(1), inst->tempIndices->at(0), TempOp::CMP);
+                assm.jg_1(x64asm::Label{labelStr});
+                break;
+            };
+        case IrOp::IfGeq:
+            {
+                LOG(to_string(instructionIndex) + ": IfGeq");
+                string labelStr = to_string(inst->op0.value());
+                moveTemp32(inst->tempIndices->at(1), inst->tempIndices->at(0), TempOp::CMP);
+                assm.jge_1(x64asm::Label{labelStr});
+                break;
+            };
+        case IrOp::IfEqInteger:
+            {
+                LOG(to_string(instructionIndex) + ": IfEqInteger");
+                string labelStr = to_string(inst->op0.value());
+                moveTemp32(inst->tempIndices->at(1), inst->tempIndices->at(0), TempOp::CMP);
+                assm.je_1(x64asm::Label{labelStr});
+                break;
+            };
+        case IrOp::IfClosureOf:
+            {
+                LOG(to_string(instructionIndex) + ": IfClosureOf");
+                string labelStr = to_string(inst->op0.value());
+                string doneStr = CLOSURE_CHECK_LABEL + to_string(instructionIndex);
+                x64asm::R64 reg = getScratchReg();
+                moveTemp(reg, inst->tempIndices->at(0));
+                // tagged values aren't closures
+                assm.assemble({x64asm::TEST_R64_IMM32, {reg, x64asm::Imm32{ALL_TAG}}});
+                assm.jne_1(x64asm::Label{doneStr});
+                assm.cmp(x64asm::M8{reg, x64asm::Imm32{kindOffset()}},
+                        x64asm::Imm8{(uint8_t) ValueKind::Closure});
+                assm.jne_1(x64asm::Label{doneStr});
+                assm.mov(reg, x64asm::M64{reg, x64asm::Imm32{closureFuncOffset()}});
+                moveTemp(reg, inst->tempIndices->at(1), TempOp::CMP);
+                bindLabel(doneStr);
+                returnScratchReg(reg);
+                assm.je_1(x64asm::Label{labelStr});
+                break;
+            };
        case IrOp::AssertInteger:
             {
                 LOG(to_string(instructionIndex) + ": AssertInteger");
+                assertTag(inst->tempIndices->at(0), INT_TAG, (void *) &(helper_assert_int));
+                break;
+            };
+        case IrOp::GuardInteger:
+            {
+                LOG(to_string(instructionIndex) + ": GuardInteger");
                 x64asm::R64 reg = getScratchReg();
-                // put the operand in a reg
                 moveTemp(reg, inst->tempIndices->at(0)); 
-                // and with 3 to leave the tag in reg
                 assm.and_(reg, x64asm::Imm32{ALL_TAG});
-                // do a comparison with the real tag
                 assm.cmp(reg, x64asm::Imm32{INT_TAG});
-                // error if its wrong
-                assm.jne_1(x64asm::Label{TYPE_ERROR_LABEL}); 
+                // the deopt stub sees the same stack as the guard
                 returnScratchReg(reg);
+                string labelStr = DEOPT_LABEL + to_string(inst->op0.value());
+                assm.jne_1(x64asm::Label{labelStr}); 
                 break;
             };
         case IrOp::AssertBoolean:
             {
                 LOG(to_string(instructionIndex) + ": AssertBool");
-                x64asm::R64 reg = getScratchReg();
-                // put the operand in a reg
-                moveTemp(reg, inst->tempIndices->at(0)); 
-                // and with 3 to leave the tag in reg
-                assm.and_(reg, x64asm::Imm32{ALL_TAG});
-                // do a comparison with the real tag
-                assm.cmp(reg, x64asm::Imm32{BOOL_TAG});
-                // error if its wrong
-                assm.jne_1(x64asm::Label{TYPE_ERROR_LABEL}); 
-                returnScratchReg(reg);
+                assertTag(inst->tempIndices->at(0), BOOL_TAG, (void *) &(helper_assert_bool));
                 break;
             };
         case IrOp::AssertString:
             {
                 LOG(to_string(instructionIndex) + ": AssertString");
-                x64asm::R64 reg = getScratchReg();
-                // put the operand in a reg
-                moveTemp(reg, inst->tempIndices->at(0)); 
-                // and with 3 to leave the tag in reg
-                assm.and_(reg, x64asm::Imm32{ALL_TAG});
-                // do a comparison with the real tag
-                assm.cmp(reg, x64asm::Imm32{STR_TAG});
-                // error if its wrong
-                assm.jne_1(x64asm::Label{TYPE_ERROR_LABEL}); 
-                returnScratchReg(reg);
+                assertTag(inst->tempIndices->at(0), STR_TAG, (void *) &(helper_assert_str));
                 break;
             };
         case IrOp::AssertRecord:
             {
                 LOG(to_string(instructionIndex) + ": AssertRecord");
-                vector<tempptr_t> temps = {
-                    inst->tempIndices->at(0)
-                };
-                callHelper((void *) &(helper_assert_record), {}, temps, nullopt);
+                assertKind(inst->tempIndices->at(0), ValueKind::Record, (void *) &(helper_assert_record));
                 break;
             };
         case IrOp::AssertFunction:
             {
                 LOG(to_string(instructionIndex) + ": AssertFunction");
-                vector<tempptr_t> temps = {
-                    inst->tempIndices->at(0)
-                };
-                callHelper((void *) &(helper_assert_func), {}, temps, nullopt);
+                assertKind(inst->tempIndices->at(0), ValueKind::Function, (void *) &(helper_assert_func));
                 break;
             };
         case IrOp::AssertClosure:
             {
                 LOG(to_string(instructionIndex) + ": AssertClosure");
-                vector<tempptr_t> temps = {
-                    inst->tempIndices->at(0)
-                };
-                callHelper((void *) &(helper_assert_closure), {}, temps, nullopt);
+                assertKind(inst->tempIndices->at(0), ValueKind::Closure, (void *) &(helper_assert_closure));
                 break;
             };
         case IrOp::AssertValWrapper:
             {
                 LOG(to_string(instructionIndex) + ": AssertValWrapper");
-                vector<tempptr_t> temps = {
-                    inst->tempIndices->at(0)
-                };
-                callHelper((void *) &(helper_assert_valwrapper), {}, temps, nullopt);
+                assertKind(inst->tempIndices->at(0), ValueKind::ValWrapper, (void *) &(helper_assert_valwrapper));
                 break;
             };
         case IrOp::UnboxInteger:
@@ -771,6 +1057,8 @@ void IrInterpreter::executeStep() {
                 moveTemp(reg, inst->tempIndices->at(1));
                 // left shift two places; pad w/ zeros
                 assm.assemble({x64asm::SHL_R64_IMM8, {reg, x64asm::Imm8{SHIFT}}});
+                // keep the low 32 bits like make_ptr does
+                assm.movsxd(reg, getRegBottomHalf(reg));
                 // xor w/ the right tag
                 assm.or_(reg, x64asm::Imm32{INT_TAG});
                 // put it back in the right temp 
@@ -808,7 +1096,7 @@ void IrInterpreter::executeStep() {
                 LOG(to_string(instructionIndex) + ": AddLabel");
                 string labelStr = to_string(inst->op0.value());
                 LOG("adding label " + labelStr);
-                assm.bind(x64asm::Label{labelStr});
+                bindLabel(labelStr);
                 break;
             };
         case IrOp::GarbageCollect:
@@ -3,11 +3,18 @@
 #include "../vm/interpreter.h"
 #include "../opt/opt_tag_ptr.h"
 #include "../ir.h"
+#include "../opt/opt_cfg.h"
 #include "helpers.h"
 #include <set>
+#include <functional>
 #include <cassert>
 
-#define TYPE_ERROR_LABEL "typeErrorLabel"
+#define DEOPT_LABEL "deoptLabel"
+#define DIV_ZERO_LABEL "divZeroLabel"
+#define SLOW_PATH_LABEL "slowPathLabel"
+#define SLOW_PATH_DONE_LABEL "slowPathDoneLabel"
+#define CLOSURE_CHECK_LABEL "closureCheckLabel"
+#define KIND_CHECK_LABEL "kindCheckLabel"
 
 class Interpreter;
 class IrInterpreter;
@@ -28,7 +35,6 @@ private:
     IrFunc* func;
     int instructionIndex;
     bool finished;
-    vector<bool> isLocalRef;
     uint32_t spaceToAllocate;
 
     void callHelper(void* fn, vector<x64asm::Imm64> args, vector<tempptr_t> temps, opttemp_t returnTemp);
@@ -37,22 +43,43 @@ private:
     // prolog and helpers
     void prolog();
     void installLocalVar(tempptr_t temp, uint32_t localIdx);
-    void installLocalRefVar(tempptr_t temp, uint32_t localIdx);
     void installLocalNone(tempptr_t temp);
-    void installLocalRefNone(tempptr_t temp);
 
     void epilog();
+    void deoptStub(int pointIndex);
 
     void executeStep();
     uint32_t getTempOffset(tempptr_t temp);
     uint32_t getLocalOffset(uint32_t localIndex);
     uint32_t getRefArrayOffset();
+    uint32_t cellValueOffset();
+    uint32_t kindOffset();
+    uint32_t closureFuncOffset();
     void getRbpOffset(uint32_t offset);
     void loadTemp(x64asm::R32 reg, tempptr_t temp);
     void loadTemp(x64asm::R64 reg, tempptr_t temp);
     void storeTemp(x64asm::R32 reg, tempptr_t temp);
     void storeTemp(x64asm::R64 reg, tempptr_t temp);
     void comparisonSetup(instptr_t inst, TempBoolOp tempBoolOp);
+    // jumps to label unless the temp has the given tag
+    void checkTag(tempptr_t temp, uint32_t tag, string label);
+    // jumps to label unless the temp points to a value of the given kind
+    void checkKind(tempptr_t temp, ValueKind kind, string label);
+    // checks the temp's kind inline, leaving the helper, which throws, to a
+    // slow path
+    void assertKind(tempptr_t temp, ValueKind kind, void* helper);
+    // the same for a tag
+    void assertTag(tempptr_t temp, uint32_t tag, void* helper);
+    // slow paths are emitted after the body of the function, so the common
+    // case falls straight through. each one jumps back when it is done
+    vector<function<void()>> slowPaths;
+    int addSlowPath(function<void()> emit);
+    // the caller-saved regs holding temps live at each instruction; helper
+    // calls only save these, or all of them outside the instructions
+    vector<vector<x64asm::R64>> liveCallerSaved;
+    bool saveAllRegs = true;
+    vector<x64asm::R64> savedRegs;
+    void computeLiveRegs();
     x64asm::R32 getRegBottomHalf(x64asm::R64 reg);
 
     int regPopCount = 0;
@@ -60,7 +87,7 @@ private:
     void Pop(x64asm::R64 reg);
     void Pop();
     void Push(x64asm::R64 reg);
-    // generates a new free reg by pushing/popping and returns it
+    // returns the scratch reg, which no temp lives in
     x64asm::R64 getScratchReg();
     // returns a scratch reg
     void returnScratchReg(x64asm::R64 reg);
@@ -76,6 +103,19 @@ private:
     void moveTemp(x64asm::R32 dest, tempptr_t src, TempOp tempOp);
     void moveTemp(tempptr_t dest, x64asm::R32 src);
     void moveTemp(tempptr_t dest, x64asm::Imm32 src, TempOp tempOp);
+    // sets a temp to a constant, in the shortest form that holds it
+    void moveImm(tempptr_t dest, uint64_t value);
+
+    // peephole: a load of the stack slot the last instruction stored to
+    // reads the reg it stored instead, unless a label was bound between
+    // them. the slot accessors below keep track of the last store
+    size_t lastStoreEnd = -1;
+    uint32_t lastStoreOffset;
+    x64asm::R64 lastStoreReg = x64asm::r10;
+    size_t lastLabelAt = -1;
+    void bindLabel(string label);
+    void loadSlot(x64asm::R64 dest, uint32_t offset);
+    void storeSlot(uint32_t offset, x64asm::R64 src);
 
 public:
     //static const x64asm::R64 argRegs[];
@@ -84,12 +124,13 @@ public:
     static const int numCallerSaved = 9;
     static const int numCalleeSaved = 5;
     static const int numArgRegs = 6;
-    IrInterpreter(IrFunc* irFunction, Interpreter* vmInterpreterPointer, vector<bool> isLocalRefVec);
+    IrInterpreter(IrFunc* irFunction, Interpreter* vmInterpreterPointer);
     x64asm::Function run(); // runs the program
 };
 
 enum class TempOp {
     MOVE,
+    ADD,
     SUB,
     MUL,
     CMP, 
@@ -99,5 +140,6 @@ enum class TempOp {
 
 enum class TempBoolOp {
     CMOVNLE,
-    CMOVNL
+    CMOVNL,
+    CMOVE
 };
@@ -253,7 +253,7 @@ bool BytecodeCompiler::putVarInFunc(string& varName, stptr_t table, Function* fu
         case LOCAL:
             d->index = func->local_vars_.size();
             func->local_vars_.push_back(varName);
-            if (d->isReferenced) {
+            if (d->isReferenced && !d->byValue) {
                 d->refIndex = func->local_reference_vars_.size();
                 func->local_reference_vars_.push_back(varName);
             }
@@ -261,6 +261,7 @@ bool BytecodeCompiler::putVarInFunc(string& varName, stptr_t table, Function* fu
         case FREE:
             d->index = func->free_vars_.size();
             func->free_vars_.push_back(varName);
+            func->free_by_value_.push_back(d->capturedByValue());
             return false;
         default:
             throw "unknown vartype";
@@ -327,6 +328,12 @@ void BytecodeCompiler::visit(FunctionExpr& exp) {
         string var = *it;
         // get that var's description in the parent
         desc_t d = curTable->vars.at(var);
+        if (d->capturedByValue()) {
+            // the closure gets a copy of the value
+            Identifier id = Identifier(var);
+            addInstructions(id);
+            continue;
+        }
         int i;
         // can push a ref to a local ref var or a free var
         if (d->type==LOCAL && d->isReferenced) {
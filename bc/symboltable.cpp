@@ -48,21 +48,68 @@ stvec_t SymbolTableBuilder::eval(Expression& exp) {
     for (stptr_t t : tables) {
         for (string var : t->referenced) {
             if (t->vars.count(var) == 0) { // it's not defined in cur frame
-                desc_t d = markLocalRef(var, t->parent);
+                desc_t d = markLocalRef(var, t->parent, t->stmtIndex);
                 if (d->type == GLOBAL) {
                     t->vars[var] = make_shared<VarDesc>(VarDesc(GLOBAL));
                 } else {
                     t->vars[var] = make_shared<VarDesc>(VarDesc(FREE));
+                    t->vars[var]->origin = d;
                 }
             }
         }
     }
-    
+
+    // closures holding values instead of ValWrappers still need to tell
+    // apart the activations they come from to compare like closures
+    // sharing them would, so they also capture a ref to a var local to
+    // the nearest function whose locals they hold by value
+    for (stptr_t t : tables) {
+        stptr_t origin = nullptr;
+        int depth = 0;
+        for (auto& entry : t->vars) {
+            if (entry.second->type != FREE || !entry.second->capturedByValue()) {
+                continue;
+            }
+            int d = 0;
+            stptr_t p = t->parent;
+            while (p->vars.at(entry.first)->type != LOCAL) {
+                p = p->parent;
+                d++;
+            }
+            if (!origin || d < depth) {
+                origin = p;
+                depth = d;
+            }
+        }
+        if (!origin) {
+            continue;
+        }
+        string var = activationVar(origin);
+        if (origin->vars.count(var) == 0) {
+            origin->vars[var] = make_shared<VarDesc>(VarDesc(LOCAL));
+        }
+        if (t->vars.count(var) == 0) {
+            desc_t d = make_shared<VarDesc>(VarDesc(FREE));
+            d->origin = markLocalRef(var, t->parent, t->stmtIndex);
+            t->vars[var] = d;
+        }
+    }
+
     // now return the list of tables
     return tables;
 }
 
-desc_t SymbolTableBuilder::markLocalRef(string varName, stptr_t child) {
+string SymbolTableBuilder::activationVar(stptr_t table) {
+    // programs can't name a var starting with $, so this can't clash with
+    // theirs; nested functions get different ones by their depth
+    int depth = 0;
+    for (stptr_t p = table->parent; p; p = p->parent) {
+        depth++;
+    }
+    return "$frame" + to_string(depth);
+}
+
+desc_t SymbolTableBuilder::markLocalRef(string varName, stptr_t child, int captureAt) {
     // function to perform reference chasing 
     // given a pointer to a child and a varName, returns the appropriate
     // VarDesc, while keeping track of metadata like which parent vars 
@@ -76,6 +123,11 @@ desc_t SymbolTableBuilder::markLocalRef(string varName, stptr_t child) {
     if (it != frameVars.end()) {
         desc_t d = it->second;
         d->isReferenced = true;
+        // the closure can copy the value if it can't change after the
+        // closure is made
+        auto defined = child->definedAt.find(varName);
+        d->byValue = d->byValue && defined != child->definedAt.end() &&
+            defined->second < captureAt;
         return d;
     } else {
         // this means we are in a situation like childchild -> child ->parent
@@ -83,10 +135,11 @@ desc_t SymbolTableBuilder::markLocalRef(string varName, stptr_t child) {
         // distance ancestor, and we are currently at child. 
         // If we find the var and it is NOT global, this frame 
         // must contain a free variable to link childhild to parent
-        desc_t retD = markLocalRef(varName, child->parent);
+        desc_t retD = markLocalRef(varName, child->parent, child->stmtIndex);
         if (retD->type != GLOBAL) {
             desc_t d = make_shared<VarDesc>(VarDesc(FREE));
             d->isReferenced = true;
+            d->origin = retD;
             child->vars[varName] = d;
         }
         return retD;
@@ -94,9 +147,14 @@ desc_t SymbolTableBuilder::markLocalRef(string varName, stptr_t child) {
 }
 
 void SymbolTableBuilder::visit(Block& exp) {
-    for (Statement* s : exp.stmts) {
-        s->accept(*this);
+    blockDepth++;
+    for (int i = 0; i < exp.stmts.size(); i++) {
+        if (blockDepth == 1) {
+            stmtIndex = i;
+        }
+        exp.stmts[i]->accept(*this);
     }
+    blockDepth--;
 }
 
 void SymbolTableBuilder::visit(Global& exp) {
@@ -114,6 +172,10 @@ void SymbolTableBuilder::visit(Assignment& exp) {
     auto id = dynamic_cast<Identifier*>(lhsPtr);
     if (id != NULL) {
         local.insert(id->name);
+        assignCount[id->name]++;
+        if (blockDepth == 1) {
+            assignedAt[id->name] = stmtIndex;
+        }
     } else {
         // record derefs are handled normally
         exp.lhs.accept(*this);
@@ -148,17 +210,25 @@ void SymbolTableBuilder::visit(FunctionExpr& exp) {
 
     // mark parent
     funcTable->parent = curTable;
+    funcTable->stmtIndex = stmtIndex;
     curTable = funcTable;
 
     // save the sets of the parent
     nameset_t parentGlobals = global;
     nameset_t parentLocals = local;
     nameset_t parentReferenced = referenced;
+    map<string, int> parentAssignCount = assignCount;
+    map<string, int> parentAssignedAt = assignedAt;
+    int parentBlockDepth = blockDepth;
+    int parentStmtIndex = stmtIndex;
     
     // reset sets 
     global.clear();
     local.clear();
     referenced.clear();
+    assignCount.clear();
+    assignedAt.clear();
+    blockDepth = 0;
     
     // args are local vars
     for (Identifier* arg : exp.args) {
@@ -178,6 +248,20 @@ void SymbolTableBuilder::visit(FunctionExpr& exp) {
         funcTable->vars[var] = d;
     }
 
+    // params that are never assigned are set before the body runs, and
+    // locals assigned once at the top level of the body are set from then
+    // on
+    for (Identifier* arg : exp.args) {
+        if (assignCount.count(arg->name) == 0) {
+            funcTable->definedAt[arg->name] = -1;
+        }
+    }
+    for (auto& assigned : assignedAt) {
+        if (assignCount[assigned.first] == 1) {
+            funcTable->definedAt[assigned.first] = assigned.second;
+        }
+    }
+
     // store the referenced vars
     funcTable->referenced = referenced;
 
@@ -185,6 +269,10 @@ void SymbolTableBuilder::visit(FunctionExpr& exp) {
     global = parentGlobals;
     local = parentLocals;
     referenced = parentReferenced;
+    assignCount = parentAssignCount;
+    assignedAt = parentAssignedAt;
+    blockDepth = parentBlockDepth;
+    stmtIndex = parentStmtIndex;
 
     // reset the curTable pointer
     curTable = funcTable->parent;
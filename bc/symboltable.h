@@ -35,10 +35,18 @@ enum VarType {
 struct VarDesc {
     VarType type;
     bool isReferenced;
+    // a captured local that is only assigned before any closure captures
+    // it; closures hold its value instead of sharing a ValWrapper
+    bool byValue;
     int32_t index;
     int32_t refIndex;
-    VarDesc(): type(LOCAL), isReferenced(false) {};
-    VarDesc(VarType type): type(type), isReferenced(false) {};
+    // for free vars, the desc of the local they name
+    desc_t origin;
+    VarDesc(): type(LOCAL), isReferenced(false), byValue(true) {};
+    VarDesc(VarType type): type(type), isReferenced(false), byValue(true) {};
+    bool capturedByValue() {
+        return type == FREE ? origin->capturedByValue() : isReferenced && byValue;
+    }
 };
 
 struct SymbolTable {
@@ -46,6 +54,11 @@ public:
     map<string, desc_t> vars;
     stptr_t parent;
     nameset_t referenced;
+    // local -> the top-level statement of the body that is its only
+    // assignment, or -1 for parameters that are never assigned
+    map<string, int> definedAt;
+    // the top-level statement of the parent's body this function is in
+    int stmtIndex = -1;
 };
 
 class SymbolTableBuilder : public Visitor {
@@ -54,6 +67,10 @@ private:
     nameset_t global;
     nameset_t local;
     nameset_t referenced;
+    map<string, int> assignCount;
+    map<string, int> assignedAt;  // local -> top-level statement assigning it
+    int blockDepth = 0;
+    int stmtIndex = -1;
 
     // persistent vars
     nameset_t sneakyGlobals; // globals not declared in global frame
@@ -61,7 +78,12 @@ private:
     stptr_t curTable;
 public:
     stvec_t eval(Expression& exp);
-    desc_t markLocalRef(string varName, stptr_t child);
+    // captureAt is the top-level statement of child's body holding the
+    // function that refers to varName
+    desc_t markLocalRef(string varName, stptr_t child, int captureAt);
+    // name of the var a function's closures capture to know which of its
+    // activations they come from
+    string activationVar(stptr_t table);
     virtual void visit(Block& exp) override;
     virtual void visit(Global& exp) override;
     virtual void visit(Assignment& exp) override;
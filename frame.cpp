@@ -5,20 +5,14 @@
 
 using namespace std;
 
-// instruction helpers
-int Frame::numInstructions() {
-    return func->instructions.size();
-}
-
-BcInstruction& Frame::getCurrInstruction() {
-    return func->instructions[instructionIndex];
-}
-
-void Frame::checkLegalInstruction() {
-    if (instructionIndex < 0 || instructionIndex >= numInstructions()) {
-        throw RuntimeException("instruction " + to_string(instructionIndex) + " out of bounds");
-    }
-}
+Frame::Frame(Function* func, vector<tagptr_t>* stack, size_t base):
+    func(func),
+    pc(func->code_.data()),
+    stack(stack),
+    base(base),
+    refsBase(base + func->local_vars_.size()),
+    opBase(refsBase + func->local_reference_vars_.size() + func->free_vars_.size()),
+    sp(opBase) {}
 
 // function value helpers
 tagptr_t Frame::getConstantByIndex(int index) {
@@ -59,91 +53,64 @@ string Frame::getRefByIndex(int index) {
     return func->free_vars_[index - func->local_reference_vars_.size()];
 }
 
-// var map helpers
-tagptr_t Frame::getLocalVar(string name) {
-    if (vars.count(name) != 0) {
-        tagptr_t result = vars[name]->ptr;
-        if (result == NULL_PTR) {
-            throw UninitializedVariableException(name + " is not defined");
-        }
-        return result;
+// local helpers
+tagptr_t Frame::getLocal(int index) {
+    int slot = func->local_ref_slots_[index];
+    tagptr_t result = slot < 0 ? (*stack)[base + index] : cast_val<ValWrapper>(ref(slot))->ptr;
+    if (result == NULL_PTR) {
+        throw UninitializedVariableException(getLocalByIndex(index) + " is not defined");
     }
-    throw UninitializedVariableException(name + " is not defined");
+    return result;
 }
 
-ValWrapper* Frame::getRefVar(string name) {
-    if (vars.count(name) != 0) {
-        return vars[name];
-    }
-    throw RuntimeException(name + " has not been created in its frame's vars");
-}
-
-void Frame::setLocalVar(string name, tagptr_t val) {
-    if (vars.count(name) == 0) {
-        vars[name] = collector->allocate<ValWrapper>(val);
-        collector->increment(sizeof(name) + name.size() + sizeof(val));
+void Frame::setLocal(int index, tagptr_t val) {
+    int slot = func->local_ref_slots_[index];
+    if (slot < 0) {
+        (*stack)[base + index] = val;
     } else {
-        vars[name]->ptr = val;
+        cast_val<ValWrapper>(ref(slot))->ptr = val;
     }
 }
 
-void Frame::setRefVar(string name, tagptr_t val) {
-    if (vars.count(name) == 0) {
-        collector->increment(sizeof(name) + name.size() + sizeof(val));
-    }
-    ValWrapper* v = cast_val<ValWrapper>(val);
-    vars[name] = v;
+tagptr_t& Frame::ref(int index) {
+    return (*stack)[refsBase + index];
 }
 
 // operand stack helpers
 void Frame::opStackPush(tagptr_t val) {
-    collector->increment(sizeof(val));
-    opStack.push_back(val);
+    // the frame was made with room for the most operands its function uses
+    (*stack)[sp++] = val;
 }
 
 tagptr_t Frame::opStackPeek() {
-    if (opStack.empty()) {
+    return opStackPeek(0);
+}
+
+tagptr_t Frame::opStackPeek(int depth) {
+    if (depth >= opStackSize()) {
         throw InsufficientStackException("peek at empty stack");
     }
-    return opStack.back();
+    return (*stack)[sp - 1 - depth];
 }
 
 tagptr_t Frame::opStackPop() {
-    if (opStack.empty()) {
+    if (sp == opBase) {
         throw InsufficientStackException("pop from empty stack");
     }
-    tagptr_t top = opStack.back();
-    int size = sizeof(top);
-    collector->increment(-size);
-    opStack.pop_back();
-    return top;
+    return (*stack)[--sp];
+}
+
+int Frame::opStackSize() {
+    return sp - opBase;
 }
 
 void Frame::follow(CollectedHeap& heap) {
-    // follow the function it contains
-    // As well as all the stuff on the op stack?
+    // follow the function, and the locals, refs and operands
     heap.markSuccessors(func);
-    for (tagptr_t v : opStack) {
-        if (!is_tagged(v)) {
+    for (size_t i = base; i < sp; i++) {
+        tagptr_t v = (*stack)[i];
+        if (v != NULL_PTR && !is_tagged(v)) {
             heap.markSuccessors(get_collectable(v));
         }
     }
-   	for (string arg : func->local_vars_) {
-		if (vars.count(arg) != 0) {
-			Collectable* localVar = vars[arg];
-   	    	heap.markSuccessors(localVar); }
-   	}
-   	for (string arg : func->local_reference_vars_) {
-		if (vars.count(arg) != 0) {
-			Collectable* localRef = vars[arg];
-   	    	heap.markSuccessors(localRef);
-		}
-   	}
-}
-
-size_t Frame::getSize() {
-    size_t overhead = sizeof(Frame);
-    size_t stackSize = getStackSize(opStack);
-    size_t varsSize = getMapSize(vars);
-    return overhead + stackSize + varsSize;
 }
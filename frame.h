@@ -10,41 +10,37 @@
 #include "types.h"
 #include "gc/gc.h"
 #include <string>
-#include <map>
-#include <list>
+#include <vector>
 
 using namespace std;
 
-typedef map<string, ValWrapper*> VarMap;
-
-class Frame : public Collectable {
+class Frame {
     // Class representing a stack frame in interpreter execution
-
-    // and local reference names to shared ValWrappers
-    void follow(CollectedHeap& heap) override;
-    size_t getSize() override;
 public:
-    // vector of local variable names to values (stored in ValWrapper)
-    VarMap vars;
     // function that the frame is for
     Function* func;
-    // operand stack
-    list<tagptr_t> opStack;
-    // index of current instruction in func's instructions list
-    int instructionIndex = 0;
-    // garbage collector
-    CollectedHeap* collector;
-    // offset to keep track of stuff
-    int offset = 0;
+    // next instruction in func's code_ to run. the running frame's is only
+    // kept in the vm's dispatch loop, and stored back when it calls
+    VmInstruction* pc;
+    // the values of every frame live one after the other in the
+    // interpreter's value stack: a frame's locals, by index in local_vars_,
+    // then its refs, by PushReference operand, then its operand stack.
+    // frames keep indices into it, so it can grow under them.
+    //
+    // the locals closures capture are kept in their ValWrappers in refs,
+    // which hold the ValWrappers of those locals and then the free vars';
+    // free vars captured by value are kept as they are
+    vector<tagptr_t>* stack;
+    size_t base;  // where the locals start
+    size_t refsBase;  // where the refs start
+    size_t opBase;  // where the operand stack starts
+    size_t sp;  // one past the top of the operand stack
 
-    Frame(Function* func): func(func) {};
+    // the stack has to have room for func's frame at base
+    Frame(Function* func, vector<tagptr_t>* stack, size_t base);
 
-    virtual ~Frame() {}
-
-    // instruction helpers
-    int numInstructions();
-    BcInstruction& getCurrInstruction();
-    void checkLegalInstruction();
+    // marks the frame's values
+    void follow(CollectedHeap& heap);
 
     // function value helpers
     tagptr_t getConstantByIndex(int index);
@@ -53,15 +49,16 @@ public:
     string getNameByIndex(int index);
     string getRefByIndex(int index);
 
-    // var map helpers
-    tagptr_t getLocalVar(string name);
-    ValWrapper* getRefVar(string name);
-
-    void setLocalVar(string name, tagptr_t val);
-    void setRefVar(string name, tagptr_t val);
+    // local helpers
+    tagptr_t getLocal(int index);
+    void setLocal(int index, tagptr_t val);
+    tagptr_t& ref(int index);
 
     // operand stack helpers
     void opStackPush(tagptr_t val);
     tagptr_t opStackPeek();
     tagptr_t opStackPop();
+    // the operand depth below the top, 0 being the top
+    tagptr_t opStackPeek(int depth);
+    int opStackSize();
 };
@@ -1,4 +1,5 @@
 #include "gc.h"
+#include <algorithm>
 #include "../exception.h"
 #include "../types.h"
 #include "../frame.h"
@@ -35,11 +36,12 @@ size_t Collectable::getStringSize(string s) {
 }
 
 /* CollectedHeap */
-CollectedHeap::CollectedHeap(int maxmem, int currentSize, list<Frame*>* frames) {
+CollectedHeap::CollectedHeap(int maxmem, int currentSize, deque<Frame>* frames, vector<ValWrapper*>* globals) {
     // maxmem is in MB
     maxSizeBytes = long(maxmem * 1000000);
     currentSizeBytes = currentSize;
     rootset = frames;
+    this->globals = globals;
 }
 void CollectedHeap::increment(int newMem) {
     // LOG("\tincreased size by " << newMem);
@@ -70,14 +72,7 @@ tagptr_t CollectedHeap::allocate() {
 }
 template<typename T>
 T* CollectedHeap::allocate(tagptr_t ptr) {
-    // to be used for ValWrapper and Frame
-    T* ret = new T(ptr);
-    registerCollectable(ret);
-    return ret;
-}
-template<typename T>
-T* CollectedHeap::allocate(Function* ptr) {
-    // to be used for ValWrapper and Frame
+    // to be used for ValWrapper
     T* ret = new T(ptr);
     registerCollectable(ret);
     return ret;
@@ -101,19 +96,42 @@ T* CollectedHeap::allocate(vector<Function*> functions_,
     registerCollectable(ret);
     return ret;
 };
-Closure* CollectedHeap::allocate(vector<ValWrapper*> refs, Function* func) {
-    Closure* ret = new Closure(refs, func);
+Closure* CollectedHeap::allocate(Function* func, size_t numRefs) {
+    if (numRefs == 0) {
+        if (func->singleton == nullptr) {
+            func->singleton = new (0) Closure(func, 0);
+            singletons.push_back(func->singleton);
+        }
+        return func->singleton;
+    }
+    Closure* ret = new (numRefs) Closure(func, numRefs);
     registerCollectable(ret);
     return ret;
 }
 void CollectedHeap::gc() {
+    gc(nullptr);
+}
+void CollectedHeap::gc(const void* stackTop) {
     // calls markSuccessors on everything in the root set
     // loop through the allocated ll. if marked = False, deallocate, decrement the size of the collector, and remove from ll. Else, set marked to False
     if (currentSizeBytes > maxSizeBytes / 2) {
         LOG("STARTING GC: size = " << currentSizeBytes << "/" << maxSizeBytes << ", count = " << count());
         // mark stage
-        for (auto frame = rootset->begin(); frame != rootset->end(); ++frame) {
-            markSuccessors(*frame);
+        if (stackTop != nullptr) {
+            // spills the callee-saved registers into this frame, which
+            // markStack's scan starts above, in case compiled code left
+            // the only copy of a value in one
+            __builtin_unwind_init();
+            markStack(stackTop);
+        }
+        for (Frame& frame : *rootset) {
+            frame.follow(*this);
+        }
+        for (ValWrapper* cell : *globals) {
+            markSuccessors(cell);
+        }
+        for (Closure* closure : singletons) {
+            markSuccessors(closure);
         }
         // sweep stage
         // we recount the data we are using to get a more accurate tally
@@ -131,14 +149,39 @@ void CollectedHeap::gc() {
                 ++it;
             }
         }
-        for (auto frame = rootset->begin(); frame != rootset->end(); ++frame) {
-            (*frame)->func->marked = false;
+        for (Frame& frame : *rootset) {
+            frame.func->marked = false;
+        }
+        for (Closure* closure : singletons) {
+            closure->marked = false;
         }
         LOG("ENDING GC: size = " << currentSizeBytes << ", count = " << count());
     }
     checkSize();
 }
 
+// reads every word of other functions' frames, which address sanitizer
+// would otherwise stop
+__attribute__((noinline, no_sanitize_address))
+void CollectedHeap::markStack(const void* stackTop) {
+    // compiled code reaches a closure's free vars through its refs, which
+    // start right after the closure, so a word can stand for the closure
+    // before it too. keeping an object alive by mistake is harmless
+    vector<uintptr_t> words;
+    const uintptr_t* word = (const uintptr_t*) __builtin_frame_address(0);
+    for (; word < (const uintptr_t*) stackTop; word++) {
+        uintptr_t value = *word;
+        words.push_back(value);
+        words.push_back(value - sizeof(Closure));
+    }
+    sort(words.begin(), words.end());
+    for (Collectable* c : allocated) {
+        if (binary_search(words.begin(), words.end(), (uintptr_t) c)) {
+            markSuccessors(c);
+        }
+    }
+}
+
 // Declarations for vector size
 template class vector<string>;
 template size_t Collectable::getVecSize<string>(vector<string>);
@@ -160,7 +203,6 @@ template tagptr_t CollectedHeap::allocate<Function>();
 template tagptr_t CollectedHeap::allocate<None>();
 template tagptr_t CollectedHeap::allocate<Record>();
 template ValWrapper* CollectedHeap::allocate<ValWrapper>(tagptr_t);
-template Frame* CollectedHeap::allocate<Frame>(Function*);
 
 // Declarations for native functions
 template PrintNativeFunction* CollectedHeap::allocate<PrintNativeFunction>(vector<Function*>, vector<tagptr_t>, int, vector<string>, vector<string>, vector<string>, vector<string>, vector<BcInstruction>);
@@ -1,5 +1,6 @@
 #pragma once
 #include <cstdio>
+#include <deque>
 #include <iostream>
 #include <list>
 #include <map>
@@ -78,8 +79,15 @@ private:
     long currentSizeBytes;
     void registerCollectable(Collectable* c);
     list<Collectable*> allocated;
+    // the closures functions with no free vars share. they're never
+    // collected, so they're roots, keeping their functions alive
+    vector<Closure*> singletons;
+    // marks whatever the words between this call's frame and stackTop
+    // point at, or into the refs of
+    void markStack(const void* stackTop);
 public:
-	list<Frame*>* rootset;
+	deque<Frame>* rootset;
+    vector<ValWrapper*>* globals;
 	/*
 	 * The constructor should take as an argument the maximum size of
 	 * the garbage collected heap. You get to decide what the units of
@@ -91,7 +99,7 @@ public:
      * units of maxmem: KB
      * units of currentSize: B
 	 */
-	CollectedHeap(int maxmem, int currentSize, list<Frame*>* rootset);
+	CollectedHeap(int maxmem, int currentSize, deque<Frame>* rootset, vector<ValWrapper*>* globals);
 
     /*
      * Increment our tracked currentSizeBytes
@@ -127,18 +135,11 @@ public:
 
     /*
      * This method allocates with a tagptr_t parameter, so it should return
-     * a tagptr_t to a ValWrapper or a Frame
+     * a tagptr_t to a ValWrapper
      */
 	template<typename T>
 	T* allocate(tagptr_t ptr);
 
-    /*
-     * This method allocates with a tagptr_t parameter, so it should return
-     * a tagptr_t to a ValWrapper or a Frame
-     */
-	template<typename T>
-	T* allocate(Function* ptr);
-
 	/*
 	 * For performance reasons, you may want to implement specialized
      * allocate methods to allocate particular kinds of objects.
@@ -159,8 +160,9 @@ public:
             vector<string> names_,
             vector<BcInstruction> instructions);
 
-    // for closures
-    Closure* allocate(vector<ValWrapper*> refs, Function* func);
+    // for closures; the caller fills in the refs. functions with no free
+    // vars share one closure, which is never collected
+    Closure* allocate(Function* func, size_t numRefs);
 
 	/*
      * The gc method should be called by your VM (or by other methods
@@ -175,6 +177,14 @@ public:
 	 */
 	void gc();
 
+    /*
+     * Collects like gc() while compiled code is on the stack. Its frames
+     * hold values with nothing to say which words are pointers, so every
+     * word from here up to stackTop that points at an object, or at a
+     * closure's refs, is taken to be a root
+     */
+    void gc(const void* stackTop);
+
 	/*
 	 * This is the method that is called by the follow(...) method of a
      * Collectable object. This is how a Collectable object lets the
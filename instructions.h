@@ -234,7 +234,31 @@ enum class BcOp
     // Operand 0:   N/A
     // Operand 1:   a value
     // Stack:       S :: operand 1 => S
-    Pop
+    Pop,
+
+    // The rest are never in bytecode; they are only in the code the vm
+    // decodes it into.
+
+    // Description: the end of a function, where it returns None
+    // Stack:       S => S
+    End,
+
+    // What Add, Eq and Call are rewritten into the first time they run,
+    // for the operands they saw. Each checks that it still applies, and
+    // goes back to the generic instruction for good if it doesn't.
+
+    // Description: Add of two ints
+    AddInt,
+
+    // Description: Add where either operand is a string
+    AddStr,
+
+    // Description: Eq of two ints
+    EqInt,
+
+    // Description: Call of a closure of the function in callee, which is
+    // known to take operand 0 arguments and not to be native
+    CallKnown
 };
 
 
@@ -248,3 +272,26 @@ struct BcInstruction
 };
 
 typedef vector<BcInstruction> BcInstructionList;
+
+struct Function;
+
+// An instruction as the vm runs it. Functions are decoded into these when
+// the program is loaded, with their operands checked, the labels and the
+// while markers left out, and jumps pointing at the instruction to go to.
+struct VmInstruction
+{
+    BcOp operation;
+    int32_t operand0;
+    // index in the bytecode, which feedback and deopt points refer to
+    int32_t bcIndex;
+    // Goto and If: the instruction after the label
+    VmInstruction* target;
+    // If: whether it's the back-edge of a while loop
+    bool backEdge;
+    // Add, Eq and Call: whether it was found not to be worth rewriting
+    bool generic;
+    // CallKnown: the function called
+    Function* callee;
+};
+
+typedef vector<VmInstruction> VmInstructionList;
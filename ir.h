@@ -7,6 +7,7 @@
 struct IrInstruction;
 struct IrFunc;
 struct Temp;
+class Cfg;
 
 using namespace std;
 
@@ -27,6 +28,9 @@ struct Temp {
     optint_t stackOffset = nullopt;
 	int startInterval = -1;
 	int endInterval = -1;
+	// the instructions the temp is live over, one range per block; the
+	// interval above spans all of them
+	vector<pair<int, int>> ranges;
 	Temp(int i) : index(i) {}
 };
 
@@ -129,9 +133,19 @@ enum class IrOp {
     // Description: Store a reference to a free variable into a temp
     // op0: index of the free var to store the reference of
     // temp0: temp index to store reference into
-    // Result: temp at temp0 contains reference to the local variable
+    // Result: temp at temp0 contains reference to the local variable, or
+    //         its value if it was captured by value
     PushFreeRef,
 
+    // Description: Store a reference captured by a closure into a temp
+    // op0: index of the reference in the closure's refs
+    // temp0: temp index to store reference into
+    // temp1: temp index holding the closure (must be closure)
+    // Result: temp at temp0 contains the reference, or the value if it
+    //         was captured by value; used for the free variables of an
+    //         inlined function
+    PushClosureRef,
+
     // Description: Load the value of a reference into a temp
     // temp0: temp index to store into
     // temp1: the temp storing the reference to load
@@ -141,9 +155,25 @@ enum class IrOp {
     // Description: Store the value of a temp into a local ref
     // temp0: temp of the local to store into 
     // temp1: index of the temp w/ the val to store
-    // Result: local temp0 contains the value in temp0
+    // Result: local temp0 contains the value in temp0; nothing happens if
+    //         the ref hasn't been boxed yet
     StoreLocalRef,
 
+    // Description: Start off the ref of a captured local as not boxed yet.
+    //         The local's own temp holds its value; the ref only has to
+    //         exist once a closure captures it
+    // temp0: temp to hold the ref
+    // Result: temp0 holds NULL_PTR
+    LazyLocalRef,
+
+    // Description: Box a captured local's value into its ref, unless that
+    //         was already done
+    // temp0: the ref from LazyLocalRef, which is updated in place
+    // temp1: the local's value
+    // Result: temp0 holds a ValWrapper; a new one holding temp1 if it
+    //         held NULL_PTR
+    BoxLocalRef,
+
     // Description: Allocate a record and store it to a temp
     // op0: N/A
     // temp0: temp index to allocate the record in
@@ -151,7 +181,8 @@ enum class IrOp {
     AllocRecord,
 
     // Description: Load a value from a record and store it into a temp
-    // op0: N/A
+    // op0: 1 if the load was hoisted above the check that temp1 is a
+    //      record, in which case a non-record loads None instead of throwing
     // name0: name of the field to load from
     // temp0: temp index to store the field's value into
     // temp1: temp index containing the record to look in (must be record)
@@ -222,6 +253,14 @@ enum class IrOp {
     Mul,
     Div,
 
+    // Description: adds two unboxed ints, wrapping to 32 bits like the vm
+    // op0: N/A
+    // temp0: temp index to store the result value in
+    // temp1: temp index holding right value (must be an unboxed int)
+    // temp2: temp index holding left value (must be an unboxed int)
+    // Result: temp at temp0 stores temp2 + temp1
+    AddInteger,
+
     // Description: computes unary minus
     // op0: N/A
     // temp0: temp index to store the result value in
@@ -238,6 +277,14 @@ enum class IrOp {
     Gt,
     Geq,
 
+    // Description: compares two unboxed ints for equality
+    // op0: N/A
+    // temp0: temp index to store the result value in
+    // temp1: temp index holding right value (must be an unboxed int)
+    // temp2: temp index holding left value (must be an unboxed int)
+    // Result: temp at temp0 stores unboxed bool temp2 == temp1
+    EqInteger,
+
     // Description: computes an equality between two vals (semantics from A2)
     // op0: N/A
     // temp0: temp index to store the result value in
@@ -273,12 +320,48 @@ enum class IrOp {
     // Result: transfers execution to the label if temp at temp0 is true
     If,
 
+    // Description: compares two tagged ints and moves to a given label
+    // op0: index of the label to jump to conditionally; should be unique
+    // temp0: temp index holding right value (must be int)
+    // temp1: temp index holding left value (must be int)
+    // Result: transfers execution to the label if left > right
+    IfGt,
+
+    // Description: compares two tagged ints and moves to a given label
+    // op0: index of the label to jump to conditionally; should be unique
+    // temp0: temp index holding right value (must be int)
+    // temp1: temp index holding left value (must be int)
+    // Result: transfers execution to the label if left >= right
+    IfGeq,
+
+    // Description: compares two tagged ints and moves to a given label
+    // op0: index of the label to jump to conditionally; should be unique
+    // temp0: temp index holding right value (must be int)
+    // temp1: temp index holding left value (must be int)
+    // Result: transfers execution to the label if left == right
+    IfEqInteger,
+
+    // Description: checks whether a temp is a closure of a given function
+    // op0: index of the label to jump to conditionally; should be unique
+    // temp0: temp index holding the value to check
+    // temp1: temp index holding the function (a Function*)
+    // Result: transfers execution to the label if temp0 is a closure whose
+    //         function is temp1
+    IfClosureOf,
+
     // Description: asserts that a temp is an integer
     // op0: N/A
     // temp0: temp index of value to check
     // Result: throws RuntimeError if the temp is not an integer
     AssertInteger,
 
+    // Description: checks a speculative assumption that a temp is an integer
+    // op0: index into the function's deopt points
+    // temp0: temp index of value to check
+    // Result: if the temp is not an integer, leaves compiled code and
+    // finishes the call in the vm from the given deopt point
+    GuardInteger,
+
     // Description: asserts that a temp is a bool
     // op0: N/A
     // temp0: temp index of value to check
@@ -351,6 +434,13 @@ enum class IrOp {
     // op0: index of label to add
     // Result: adds label_op0 to this point in asm execution
     AddLabel,
+    // Description: merges the versions of a local coming from each
+    // predecessor of a block; only exists while the cfg is in ssa form
+    // op0: index of the local being merged
+    // temp0: temp to hold the merged value
+    // temps 1-m: the value coming from each predecessor, in order
+    // Result: temp0 stores the temp of the predecessor control came from
+    Phi,
 
     // Description: runs the garbage collector
     GarbageCollect
@@ -429,6 +519,19 @@ struct IrInstruction {
     }
 };
 
+// Describes the vm state at a bytecode instruction that compiled code can
+// deoptimize to when one of its speculative guards fails
+struct DeoptPoint {
+    Function* func;  // bytecode function to resume in
+    int bcIndex;  // bytecode instruction to resume at
+    TempList locals;  // temps holding each local, in order
+    TempList stack;  // temps holding the operand stack, bottom first
+    TempList refs;  // refs of the captured locals, in order; NULL_PTR if not boxed yet
+    DeoptPoint(Function* func, int bcIndex):
+        func(func),
+        bcIndex(bcIndex) {};
+};
+
 struct IrFunc {
     IrInstList instructions;
     vector<tagptr_t> constants_;
@@ -440,6 +543,14 @@ struct IrFunc {
     // TODO: rn hard-coding this at 0, but we need to actually keep track 
     // of our refs somehow in the ir-interpreter
     int32_t ref_count_ = 0;
+    // deopt points used by guards; these must outlive the compiled code, so
+    // the interpreter frees them along with it
+    vector<DeoptPoint*> deoptPoints;
+    // set while the function is in ssa form; passes work on its blocks
+    // rather than on instructions
+    Cfg* cfg = nullptr;
+    // calls the vm has only seen calling one function, and that function
+    map<instptr_t, Function*> callTargets;
 
     IrFunc(IrInstList instructions,
         vector<tagptr_t> constants_,
@@ -457,5 +568,16 @@ struct IrFunc {
         parameter_count_(parameter_count_),
         local_count_(local_count_),
         ref_count_(ref_count_) {};
+
+    // index of a constant, adding it if it isn't there yet
+    int constantIndex(tagptr_t value) {
+        for (int i = 0; i < constants_.size(); i++) {
+            if (constants_[i] == value) {
+                return i;
+            }
+        }
+        constants_.push_back(value);
+        return constants_.size() - 1;
+    }
 };
 
@@ -18,8 +18,6 @@ tempptr_t IrCompiler::getNewTemp() {
 	currentTemp = temps.size();
     tempptr_t newTemp = make_shared<Temp>(currentTemp);
 	temps.push_back(newTemp);
-	newTemp->startInterval = irInsts.size();
-	newTemp->endInterval = irInsts.size() + 1;	
     return newTemp;
 }
 void IrCompiler::pushTemp(tempptr_t temp) {
@@ -30,12 +28,6 @@ tempptr_t IrCompiler::popTemp() {
     tempStack.pop();
     return temp;
 }
-void IrCompiler::checkIfUsed(tempptr_t temp) {
-	temp->endInterval = irInsts.size();	
-	if (whileLevel > 0) {
-		tempsInWhile.insert(temp);
-	}
-}
 void IrCompiler::pushInstruction(instptr_t inst) {
     irInsts.push_back(inst);
 }
@@ -65,14 +57,13 @@ void IrCompiler::doUnaryArithmetic(IrOp operation, bool toBoolean) {
     tempptr_t ret = getNewTemp();
     pushInstruction(make_shared<IrInstruction>(castOp, ret, result));
     pushTemp(ret);
-	checkIfUsed(val);
-    checkIfUsed(unboxed);
-    checkIfUsed(result);
 }
-void IrCompiler::doBinaryArithmetic(IrOp operation, bool fromBoolean, bool toBoolean) {
+void IrCompiler::doBinaryArithmetic(IrOp operation, bool fromBoolean, bool toBoolean, optint_t deoptPoint) {
     // takes in two unverified operands, asserts and casts the correct type, 
     // pushes a temp for the result of an operation, 
     // and returns a list of temps to use in the instruction 
+    // if deoptPoint is given, the operands are speculated to be ints and
+    // guarded instead of asserted
     IrOp assertOp;
     IrOp unboxOp;
     IrOp castOp;
@@ -80,6 +71,9 @@ void IrCompiler::doBinaryArithmetic(IrOp operation, bool fromBoolean, bool toBoo
     if (fromBoolean) {
         assertOp = IrOp::AssertBoolean;
         unboxOp = IrOp::UnboxBoolean;
+    } else if (deoptPoint) {
+        assertOp = IrOp::GuardInteger;
+        unboxOp = IrOp::UnboxInteger;
     } else {
         assertOp = IrOp::AssertInteger;
         unboxOp = IrOp::UnboxInteger;
@@ -94,8 +88,8 @@ void IrCompiler::doBinaryArithmetic(IrOp operation, bool fromBoolean, bool toBoo
     tempptr_t left = popTemp(); 
    
     // assert the correct type
-    pushInstruction(make_shared<IrInstruction>(assertOp, right)); 
-    pushInstruction(make_shared<IrInstruction>(assertOp, left)); 
+    pushInstruction(make_shared<IrInstruction>(assertOp, deoptPoint, right)); 
+    pushInstruction(make_shared<IrInstruction>(assertOp, deoptPoint, left)); 
 
 // generate instructions to unbox right
     tempptr_t rightUnboxed = getNewTemp();
@@ -115,20 +109,64 @@ void IrCompiler::doBinaryArithmetic(IrOp operation, bool fromBoolean, bool toBoo
 	tempptr_t ret = getNewTemp();
     pushInstruction(make_shared<IrInstruction>(castOp, ret, result));
     pushTemp(ret);
-	checkIfUsed(right);
-	checkIfUsed(left);
-	checkIfUsed(leftUnboxed);
-    checkIfUsed(rightUnboxed);
-    checkIfUsed(result);
     return;
 }
 
+void IrCompiler::doComparisonBranch(IrOp operation, int label, optint_t deoptPoint) {
+    // a comparison whose only use is a branch: check the operands are ints,
+    // then compare and jump on the tagged values directly. tagging keeps
+    // the order of ints, so nothing needs to be unboxed or boxed
+    IrOp assertOp = deoptPoint ? IrOp::GuardInteger : IrOp::AssertInteger;
+    tempptr_t right = popTemp();
+    tempptr_t left = popTemp();
+    pushInstruction(make_shared<IrInstruction>(assertOp, deoptPoint, right));
+    pushInstruction(make_shared<IrInstruction>(assertOp, deoptPoint, left));
+    TempListPtr operands = make_shared<TempList>(TempList{right, left});
+    pushInstruction(make_shared<IrInstruction>(operation, label, operands));
+}
+bool IrCompiler::feedsBranch(int bcIndex) {
+    // true if the result of the instruction at bcIndex is only used by an If
+    return bcIndex + 1 < func->instructions.size() &&
+        func->instructions[bcIndex + 1].operation == BcOp::If;
+}
+
+bool IrCompiler::speculateInts(int bcIndex) {
+    // true if the vm has only ever seen ints as operands of this instruction
+    return speculate && bcIndex < func->typeFeedback.size() &&
+        func->typeFeedback[bcIndex] == FEEDBACK_INT;
+}
+int IrCompiler::addDeoptPoint(int bcIndex) {
+    // records the locals and the current operand stack so that a guard
+    // emitted next can hand execution back to the vm at bcIndex. guards
+    // count these temps as used, so they stay live until the guard
+    DeoptPoint* point = new DeoptPoint(func, bcIndex);
+    point->locals = TempList(temps.begin(), temps.begin() + func->local_vars_.size());
+    for (auto& ref : localRefs) {
+        point->refs.push_back(ref.second);
+    }
+    stack<tempptr_t> operands = tempStack;
+    while (!operands.empty()) {
+        point->stack.push_back(operands.top());
+        operands.pop();
+    }
+    reverse(point->stack.begin(), point->stack.end());
+    deoptPoints.push_back(point);
+    return deoptPoints.size() - 1;
+}
+
 // Main functionality
 IrFunc IrCompiler::toIrFunc(Function* func) {
     func = func;
     tempStack = stack<tempptr_t>();
     irInsts = IrInstList();
 
+    for (int i = 0; i < func->local_vars_.size(); i++) {
+        if (isLocalRef.at(i)) {
+            localRefs[i] = getNewTemp();
+            pushInstruction(make_shared<IrInstruction>(IrOp::LazyLocalRef, localRefs[i]));
+        }
+    }
+
     for (int i = 0; i < func->instructions.size(); i++) {
 		BcInstruction inst = func->instructions[i];
 	    switch (inst.operation) {
@@ -144,24 +182,15 @@ IrFunc IrCompiler::toIrFunc(Function* func) {
 	            {
                     tempptr_t curr = getNewTemp();
 					pushInstruction(make_shared<IrInstruction>(IrOp::LoadFunc, inst.operand0, curr));
+                    loadedFuncs[curr->index] = func->functions_[inst.operand0.value()];
                     pushTemp(curr);
 	                break;
 	            }
 	        case BcOp::LoadLocal:
 	            {
-                    // if the local at index i is also a ref var, generate PushLocalRef, LoadRef
-                    int localIndex = inst.operand0.value();
-                    if (isLocalRef.at(localIndex)) {
-                        // it is a local ref var; generate PushLocalRef, LoadRef
-                        tempptr_t localTemp = temps.at(localIndex);
-                        tempptr_t val = getNewTemp();
-                        pushInstruction(make_shared<IrInstruction>(IrOp::LoadReference, val, localTemp));
-                        pushTemp(val);
-						checkIfUsed(localTemp);
-                    } else {
-                        tempptr_t localTemp = temps.at(localIndex);
-                        pushTemp(localTemp);
-                    }
+                    // captured locals are read from their own temp too
+                    tempptr_t localTemp = temps.at(inst.operand0.value());
+                    pushTemp(localTemp);
 	                break;
 	            }
 	        case BcOp::LoadGlobal:
@@ -174,19 +203,15 @@ IrFunc IrCompiler::toIrFunc(Function* func) {
 	            }
 	        case BcOp::StoreLocal:
 	            {
-                    IrOp op;
                     int localIndex = inst.operand0.value();
-                    if (isLocalRef.at(localIndex)) {
-                        // the local is a ref var; generate storelocalref
-                        op = IrOp::StoreLocalRef;
-                    } else {
-                        op = IrOp::StoreLocal;
-                    }
 					tempptr_t val = popTemp();
                     tempptr_t localTemp = temps.at(localIndex);
-                    pushInstruction(make_shared<IrInstruction>(op, localTemp, val));
-					checkIfUsed(val);
-					checkIfUsed(localTemp);
+                    pushInstruction(make_shared<IrInstruction>(IrOp::StoreLocal, localTemp, val));
+                    if (isLocalRef.at(localIndex)) {
+                        // closures that captured it see the new value
+                        pushInstruction(make_shared<IrInstruction>(
+                            IrOp::StoreLocalRef, localRefs.at(localIndex), localTemp));
+                    }
 	                break;
 	            }
 	        case BcOp::StoreGlobal:
@@ -194,7 +219,6 @@ IrFunc IrCompiler::toIrFunc(Function* func) {
                     optstr_t global = func->names_[inst.operand0.value()];
 					tempptr_t temp = popTemp();
 					pushInstruction(make_shared<IrInstruction>(IrOp::StoreGlobal, global, temp));
-					checkIfUsed(temp);
 	                break;
 	            }
 	        case BcOp::PushReference:
@@ -211,13 +235,19 @@ IrFunc IrCompiler::toIrFunc(Function* func) {
                                 break;
                             }
                         } 
-                        tempptr_t localTemp = temps.at(localIndex);
-                        pushTemp(localTemp);
+                        // box it now that a closure captures it
+                        tempptr_t ref = localRefs.at(localIndex);
+                        pushInstruction(make_shared<IrInstruction>(
+                            IrOp::BoxLocalRef, ref, temps.at(localIndex)));
+                        pushTemp(ref);
                     } else {
                         tempptr_t curr = getNewTemp();
                         // else, generate a PushFreeRef instruction
                         int refIndex = instrIdx - func->local_reference_vars_.size();
 					    pushInstruction(make_shared<IrInstruction>(IrOp::PushFreeRef, refIndex, curr));
+                        if (func->freeByValue(refIndex)) {
+                            freeValues.insert(curr->index);
+                        }
                         pushTemp(curr);
                     }
 	                break;
@@ -225,11 +255,13 @@ IrFunc IrCompiler::toIrFunc(Function* func) {
 	        case BcOp::LoadReference:
 	            {
                     tempptr_t ref = popTemp();
+                    if (freeValues.count(ref->index) > 0) {
+                        pushTemp(ref);
+                        break;
+                    }
                     tempptr_t curr = getNewTemp();
 					pushInstruction(make_shared<IrInstruction>(IrOp::LoadReference, curr, ref));
                     pushTemp(curr);
-                    checkIfUsed(ref);
-                    checkIfUsed(curr);
 	                break;
 	            }
 	        case BcOp::AllocRecord:
@@ -252,7 +284,6 @@ IrFunc IrCompiler::toIrFunc(Function* func) {
                     TempListPtr instTemps = make_shared<TempList>(
                                 TempList{curr, record});
 					pushInstruction(make_shared<IrInstruction>(IrOp::FieldLoad, field, instTemps));
-					checkIfUsed(record);
 	                break;
 	            }
 	        case BcOp::FieldStore:
@@ -264,16 +295,13 @@ IrFunc IrCompiler::toIrFunc(Function* func) {
                                 TempList{record, value});
 					pushInstruction(make_shared<IrInstruction>(IrOp::AssertRecord, record));
 					pushInstruction(make_shared<IrInstruction>(IrOp::FieldStore, field, instTemps));
-					checkIfUsed(value);
-					checkIfUsed(record);
 	                break;
 	            }
 	        case BcOp::IndexLoad:
 	            {
-                    // get index and cast to string
+                    // the helper makes the index a key the way the vm
+                    // does, without allocating a string for it
 					tempptr_t index = popTemp();
-                    tempptr_t indexStr = getNewTemp();
-					pushInstruction(make_shared<IrInstruction>(IrOp::CastString, indexStr, index));
 
                     // get and confirm record to load into
 					tempptr_t record = popTemp();
@@ -283,21 +311,16 @@ IrFunc IrCompiler::toIrFunc(Function* func) {
                     tempptr_t ret = getNewTemp();
                     pushTemp(ret);
                     TempListPtr instTemps = make_shared<TempList>(
-                                TempList{ret, record, indexStr});
+                                TempList{ret, record, index});
 					pushInstruction(make_shared<IrInstruction>(IrOp::IndexLoad, instTemps));
-					checkIfUsed(index);
-					checkIfUsed(indexStr);
-					checkIfUsed(record);
 	                break;
 	            }
 	        case BcOp::IndexStore:
 	            {
 					tempptr_t value = popTemp();
 
-                    // get pop and cast index to string
+                    // the index is made a key by the helper, as above
 					tempptr_t index = popTemp();
-                    tempptr_t indexStr = getNewTemp();
-					pushInstruction(make_shared<IrInstruction>(IrOp::CastString, indexStr, index));
 
                     // get and assert record
 					tempptr_t record = popTemp();
@@ -305,12 +328,8 @@ IrFunc IrCompiler::toIrFunc(Function* func) {
 
                     // store value
                     TempListPtr instTemps = make_shared<TempList>(
-                                TempList{record, value, indexStr});
+                                TempList{record, value, index});
 					pushInstruction(make_shared<IrInstruction>(IrOp::IndexStore, instTemps));
-					checkIfUsed(value);
-					checkIfUsed(index);
-					checkIfUsed(indexStr);
-					checkIfUsed(record);
 	                break;
 	            }
 	        case BcOp::AllocClosure:
@@ -320,22 +339,24 @@ IrFunc IrCompiler::toIrFunc(Function* func) {
 					for (int i = 0; i < inst.operand0; i++) {
                         // pop args 
                         tempptr_t t = popTemp();
-                        // add an instruction confirming that this is a ref
-                        pushInstruction(make_shared<IrInstruction>(IrOp::AssertValWrapper, t));
 						instTemps->push_back(t);
 					}
-					reverse(instTemps->begin(), instTemps->end());
 					tempptr_t func = popTemp();
+                    auto loaded = loadedFuncs.find(func->index);
+                    for (int i = 0; i < instTemps->size(); i++) {
+                        // add an instruction confirming that this is a ref,
+                        // unless it's captured by value
+                        if (loaded == loadedFuncs.end() || !loaded->second->freeByValue(i)) {
+                            pushInstruction(make_shared<IrInstruction>(IrOp::AssertValWrapper, instTemps->at(i)));
+                        }
+                    }
+					reverse(instTemps->begin(), instTemps->end());
 					instTemps->push_back(func);
                     pushTemp(curr);
 					instTemps->push_back(curr);
 					reverse(instTemps->begin(), instTemps->end());
 					pushInstruction(make_shared<IrInstruction>(IrOp::AssertFunction, func));
 					pushInstruction(make_shared<IrInstruction>(IrOp::AllocClosure, inst.operand0, instTemps));
-					checkIfUsed(func);
-					for (tempptr_t t: *instTemps) {
-						checkIfUsed(t);
-					}
 	                break;
 	            }
 	        case BcOp::Call:
@@ -352,22 +373,26 @@ IrFunc IrCompiler::toIrFunc(Function* func) {
 					instTemps->push_back(curr);
 					reverse(instTemps->begin(), instTemps->end());
 					pushInstruction(make_shared<IrInstruction>(IrOp::AssertClosure, clos));
-					pushInstruction(make_shared<IrInstruction>(IrOp::Call, inst.operand0, instTemps));
-					checkIfUsed(clos);
-					for (tempptr_t t: *instTemps) {
-						checkIfUsed(t);
-					}
+					instptr_t call = make_shared<IrInstruction>(IrOp::Call, inst.operand0, instTemps);
+					pushInstruction(call);
+                    auto target = func->callTargets.find(i);
+                    if (target != func->callTargets.end() && target->second != nullptr) {
+                        callTargets[call] = target->second;
+                    }
 	                break;
 	            }
 	        case BcOp::Return:
 	            {
 					tempptr_t temp = popTemp();
                     pushInstruction(make_shared<IrInstruction>(IrOp::Return, temp));
-					checkIfUsed(temp);
 	                break;
 	            }
 	        case BcOp::Add:
 	            {
+                    if (speculateInts(i)) {
+                        doBinaryArithmetic(IrOp::AddInteger, false, false, addDeoptPoint(i));
+                        break;
+                    }
                     tempptr_t tempRight = popTemp();
                     tempptr_t tempLeft = popTemp();
                     tempptr_t curr = getNewTemp();
@@ -375,8 +400,6 @@ IrFunc IrCompiler::toIrFunc(Function* func) {
                     TempListPtr instTemps = make_shared<TempList>(
                                 TempList{curr, tempRight, tempLeft});
 					pushInstruction(make_shared<IrInstruction>(IrOp::Add, instTemps));
-					checkIfUsed(tempRight);
-					checkIfUsed(tempLeft);
 	                break;
 	            }
 	        case BcOp::Sub:
@@ -401,16 +424,39 @@ IrFunc IrCompiler::toIrFunc(Function* func) {
 	            }
 	        case BcOp::Gt:
 	            {
+                    if (feedsBranch(i)) {
+                        // skip the If, it's folded into the comparison
+                        i++;
+                        doComparisonBranch(IrOp::IfGt, func->instructions[i].operand0.value());
+                        break;
+                    }
                     doBinaryArithmetic(IrOp::Gt, false, true);
 	                break;
 	            }
 	        case BcOp::Geq:
 	            {
+                    if (feedsBranch(i)) {
+                        i++;
+                        doComparisonBranch(IrOp::IfGeq, func->instructions[i].operand0.value());
+                        break;
+                    }
                     doBinaryArithmetic(IrOp::Geq, false, true);
 	                break;
 	            }
 	        case BcOp::Eq:
 	            {
+                    if (speculateInts(i) && feedsBranch(i)) {
+                        // the deopt point has to be taken before skipping
+                        // the If, so the vm resumes at the Eq
+                        int deoptPoint = addDeoptPoint(i);
+                        i++;
+                        doComparisonBranch(IrOp::IfEqInteger, func->instructions[i].operand0.value(), deoptPoint);
+                        break;
+                    }
+                    if (speculateInts(i)) {
+                        doBinaryArithmetic(IrOp::EqInteger, false, true, addDeoptPoint(i));
+                        break;
+                    }
                     tempptr_t tempRight = popTemp();
                     tempptr_t tempLeft = popTemp();
                     tempptr_t curr = getNewTemp();
@@ -418,8 +464,6 @@ IrFunc IrCompiler::toIrFunc(Function* func) {
                     TempListPtr instTemps = make_shared<TempList>(
                                 TempList{curr, tempRight, tempLeft});
 					pushInstruction(make_shared<IrInstruction>(IrOp::Eq, instTemps));
-					checkIfUsed(tempRight);
-					checkIfUsed(tempLeft);
 	                break;
 	            }
 	        case BcOp::And:
@@ -449,24 +493,13 @@ IrFunc IrCompiler::toIrFunc(Function* func) {
                     pushInstruction(make_shared<IrInstruction>(IrOp::AssertBoolean, expr));
                     pushInstruction(make_shared<IrInstruction>(IrOp::UnboxBoolean, exprVal, expr));
                     pushInstruction(make_shared<IrInstruction>(IrOp::If, inst.operand0.value(), exprVal));
-					checkIfUsed(expr);
-					checkIfUsed(exprVal);
 	                break;
 	            }
             case BcOp::StartWhile:
-                {
-					whileLevel++;
-                    break;
-                }
 	        case BcOp::EndWhile:
 	            {
-					whileLevel--;
-					if (whileLevel == 0) {
-						for (tempptr_t temp: tempsInWhile) {
-							temp->endInterval = irInsts.size();	
-						}
-						tempsInWhile.clear();
-					}
+                    // loops are found from the labels and jumps when the
+                    // cfg is built
                     break;
 	            }
             case BcOp::Label:
@@ -490,7 +523,6 @@ IrFunc IrCompiler::toIrFunc(Function* func) {
 	        case BcOp::Pop:
 	            {
                     tempptr_t temp = popTemp();
-					checkIfUsed(temp);
 	                break;
 	            }
 	        default:
@@ -509,6 +541,8 @@ IrFunc IrCompiler::toIrFunc(Function* func) {
             func->parameter_count_, 
             func->local_vars_.size(), 
             ref_count);
+    irFunc->deoptPoints = deoptPoints;
+    irFunc->callTargets = callTargets;
     return *irFunc;
 };
 
@@ -29,8 +29,18 @@ private:
 	IrInstList irInsts;
 	offset_t currentTemp = 0;
     vector<tempptr_t> temps;
-	int whileLevel = 0;
-	set<tempptr_t> tempsInWhile;
+    vector<DeoptPoint*> deoptPoints;
+    map<instptr_t, Function*> callTargets;
+    // local index -> the ref a captured local is boxed into, once a
+    // closure captures it. the local's own temp holds its value, since
+    // only this function can assign to it
+    map<int, tempptr_t> localRefs;
+    // temps holding the value of a free var captured by value, which
+    // LoadReference passes along as it is
+    set<int> freeValues;
+    // temps holding a function loaded by LoadFunc, for the AllocClosure
+    // that captures its free vars
+    map<int, Function*> loadedFuncs;
 
     // helpers
     tempptr_t getNewTemp();
@@ -38,12 +48,19 @@ private:
     tempptr_t popTemp();
     void pushInstruction(instptr_t inst);
     void doUnaryArithmetic(IrOp operation, bool toBoolean);
-    void doBinaryArithmetic(IrOp operation, bool fromBoolean, bool toBoolean);
-	void checkIfUsed(tempptr_t temp);
+    void doBinaryArithmetic(IrOp operation, bool fromBoolean, bool toBoolean, optint_t deoptPoint = nullopt);
+    void doComparisonBranch(IrOp operation, int label, optint_t deoptPoint = nullopt);
+    bool feedsBranch(int bcIndex);
+    // speculation helpers
+    bool speculateInts(int bcIndex);
+    int addDeoptPoint(int bcIndex);
 public:
     // vector of booleans corresponding to whether the local in the 
     // corresponding index is a local ref var or not
     vector<bool> isLocalRef;
+    // whether to use the vm's type feedback; code with no way back to the
+    // vm, like a function being inlined, has to turn this off
+    bool speculate = true;
     IrCompiler(Function* mainFunc, Interpreter* vmInterpreterPointer):
         func(mainFunc),
         vmPointer(vmInterpreterPointer) {
@@ -106,11 +106,10 @@ public:
         compiled_ = true;
     }
 
-    tagptr_t call(const vector<tagptr_t*> args) {
+    tagptr_t call(tagptr_t* const args[]) {
         assert(compiled_);
-        assert(args.size() == parameter_count_);
-        // copy contents into buffer
-        copy(args.begin(), args.end(), buffer_.begin());
+        // copy contents into buffer; there are parameter_count_ of them
+        copy(args, args + parameter_count_, buffer_.begin());
         tagptr_t result = trampoline_.call<tagptr_t>();
         return result;
     }
@@ -0,0 +1,162 @@
+#include "opt_box.h"
+#include <cassert>
+
+// the tag of a merge that hasn't seen any of its operands' tags yet
+#define ANY_TAG -1
+
+void BoxOpt::inferTags() {
+    IrInstList merges;
+    for (blockptr_t block : cfg->blocks) {
+        for (IrInstList* insts : {&block->phis, &block->instructions}) {
+            for (instptr_t inst : *insts) {
+                opttemp_t def = irDef(inst);
+                if (!def) {
+                    continue;
+                }
+                int index = def.value()->index;
+                defs[index] = inst;
+                switch (inst->op) {
+                    case IrOp::NewInteger:
+                        tags[index] = INT_TAG;
+                        break;
+                    case IrOp::NewBoolean:
+                        tags[index] = BOOL_TAG;
+                        break;
+                    case IrOp::CastString:
+                        tags[index] = STR_TAG;
+                        break;
+                    case IrOp::LoadConst:
+                        {
+                            tagptr_t c = func->constants_.at(inst->op0.value());
+                            if (is_tagged(c)) {
+                                tags[index] = c & ALL_TAG;
+                            }
+                            break;
+                        }
+                    case IrOp::StoreLocal:
+                    case IrOp::Phi:
+                        tags[index] = ANY_TAG;
+                        merges.push_back(inst);
+                        break;
+                    default:
+                        break;
+                }
+            }
+        }
+    }
+    // a merge has a tag if every operand has the same one. start out
+    // assuming so, to see through loops, and drop the tags that turn out
+    // not to hold
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (instptr_t inst : merges) {
+            int index = inst->tempIndices->at(0)->index;
+            if (tags.count(index) == 0) {
+                continue;
+            }
+            int tag = ANY_TAG;
+            bool known = true;
+            for (int i = 1; i < inst->tempIndices->size() && known; i++) {
+                auto it = tags.find(inst->tempIndices->at(i)->index);
+                if (it == tags.end() || (tag != ANY_TAG && it->second != ANY_TAG &&
+                            it->second != tag)) {
+                    known = false;
+                } else if (it->second != ANY_TAG) {
+                    tag = it->second;
+                }
+            }
+            if (!known) {
+                tags.erase(index);
+                changed = true;
+            } else if (tag != tags.at(index)) {
+                tags[index] = tag;
+                changed = true;
+            }
+        }
+    }
+    for (auto it = tags.begin(); it != tags.end();) {
+        if (it->second == ANY_TAG) {
+            it = tags.erase(it);
+        } else {
+            it++;
+        }
+    }
+}
+
+void BoxOpt::walk(BasicBlock* block, map<int, int> checked,
+        map<pair<IrOp, int>, tempptr_t> unboxed) {
+    IrInstList kept;
+    for (instptr_t inst : block->instructions) {
+        int tag = ANY_TAG;
+        IrOp boxOp;
+        switch (inst->op) {
+            case IrOp::AssertInteger:
+            case IrOp::GuardInteger:
+                tag = INT_TAG;
+                break;
+            case IrOp::AssertBoolean:
+                tag = BOOL_TAG;
+                break;
+            case IrOp::AssertString:
+                tag = STR_TAG;
+                break;
+            case IrOp::UnboxInteger:
+                boxOp = IrOp::NewInteger;
+                break;
+            case IrOp::UnboxBoolean:
+                boxOp = IrOp::NewBoolean;
+                break;
+            default:
+                kept.push_back(inst);
+                continue;
+        }
+        if (tag != ANY_TAG) {
+            // a check that fails never gets past itself, so the tag holds
+            // everywhere it dominates
+            int index = cfg->copySource(inst->tempIndices->at(0), defs)->index;
+            auto known = tags.find(index);
+            if ((known != tags.end() && known->second == tag) ||
+                    (checked.count(index) > 0 && checked.at(index) == tag)) {
+                changes++;
+                continue;
+            }
+            checked[index] = tag;
+            kept.push_back(inst);
+            continue;
+        }
+        tempptr_t dest = inst->tempIndices->at(0);
+        tempptr_t boxed = cfg->copySource(inst->tempIndices->at(1), defs);
+        auto def = defs.find(boxed->index);
+        if (def != defs.end() && def->second->op == boxOp) {
+            cfg->replace(dest, def->second->tempIndices->at(1));
+            changes++;
+            continue;
+        }
+        auto seen = unboxed.find({inst->op, boxed->index});
+        if (seen != unboxed.end()) {
+            cfg->replace(dest, seen->second);
+            changes++;
+            continue;
+        }
+        unboxed[{inst->op, boxed->index}] = dest;
+        kept.push_back(inst);
+    }
+    block->instructions = kept;
+    for (BasicBlock* child : block->domChildren) {
+        walk(child, checked, unboxed);
+    }
+}
+
+int BoxOpt::optimize(IrFunc* irFunc) {
+    func = irFunc;
+    cfg = irFunc->cfg;
+    if (cfg->blocks.empty()) {
+        return 0;
+    }
+    assert (cfg->isSsa());
+    inferTags();
+    walk(cfg->blocks.front().get(), map<int, int>(), map<pair<IrOp, int>, tempptr_t>());
+    cfg->replaceUses();
+    return changes + cfg->removeDeadCode();
+}
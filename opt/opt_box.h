@@ -0,0 +1,28 @@
+# pragma once
+#include "opt.h"
+#include "opt_cfg.h"
+#include "opt_tag_ptr.h"
+#include <map>
+
+// Removes boxing that is undone right away and type checks whose outcome
+// is already known, over the ssa form. A temp's tag is known from the
+// instruction that defines it (NewInteger, a constant, or a copy or phi of
+// temps with the same tag), or from a check of it that dominates.
+//
+// An UnboxInteger of a NewInteger reads the raw int the box was made from
+// instead, so chains of arithmetic keep their intermediate values unboxed
+// and the boxes that nothing else reads go away.
+class BoxOpt : public IrOpt {
+private:
+    Cfg* cfg;
+    map<int, instptr_t> defs;  // temp index -> defining instruction
+    map<int, int> tags;  // temp index -> tag it holds wherever it's defined
+    int changes = 0;
+
+    void inferTags();
+    // visits the dominator tree, knowing the tags checked above block
+    void walk(BasicBlock* block, map<int, int> checked,
+            map<pair<IrOp, int>, tempptr_t> unboxed);
+public:
+    int optimize(IrFunc* irFunc) override;
+};
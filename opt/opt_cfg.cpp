@@ -0,0 +1,717 @@
+#include "opt_cfg.h"
+#include <algorithm>
+#include <cassert>
+
+/************************
+ * INSTRUCTION HELPERS
+ ***********************/
+opttemp_t irDef(instptr_t inst) {
+    switch (inst->op) {
+        case IrOp::LoadConst:
+        case IrOp::LoadFunc:
+        case IrOp::LoadGlobal:
+        case IrOp::StoreLocal:
+        case IrOp::PushFreeRef:
+        case IrOp::PushClosureRef:
+        case IrOp::LoadReference:
+        case IrOp::LazyLocalRef:
+        case IrOp::AllocRecord:
+        case IrOp::FieldLoad:
+        case IrOp::IndexLoad:
+        case IrOp::AllocClosure:
+        case IrOp::Call:
+        case IrOp::Add:
+        case IrOp::Sub:
+        case IrOp::Mul:
+        case IrOp::Div:
+        case IrOp::AddInteger:
+        case IrOp::Neg:
+        case IrOp::Gt:
+        case IrOp::Geq:
+        case IrOp::EqInteger:
+        case IrOp::Eq:
+        case IrOp::And:
+        case IrOp::Or:
+        case IrOp::Not:
+        case IrOp::UnboxInteger:
+        case IrOp::UnboxBoolean:
+        case IrOp::NewInteger:
+        case IrOp::NewBoolean:
+        case IrOp::CastString:
+        case IrOp::Phi:
+            return inst->tempIndices->at(0);
+        default:
+            // stores write the value their operands already hold back into
+            // them, so they only count as uses
+            return nullopt;
+    }
+}
+
+TempList irUses(IrFunc* func, instptr_t inst) {
+    TempList uses;
+    int first = irDef(inst) ? 1 : 0;
+    for (int i = first; i < inst->tempIndices->size(); i++) {
+        uses.push_back(inst->tempIndices->at(i));
+    }
+    if (inst->op == IrOp::GuardInteger) {
+        DeoptPoint* point = func->deoptPoints.at(inst->op0.value());
+        uses.insert(uses.end(), point->locals.begin(), point->locals.end());
+        uses.insert(uses.end(), point->stack.begin(), point->stack.end());
+        uses.insert(uses.end(), point->refs.begin(), point->refs.end());
+    }
+    return uses;
+}
+
+bool irIsJump(instptr_t inst) {
+    switch (inst->op) {
+        case IrOp::Goto:
+        case IrOp::If:
+        case IrOp::IfGt:
+        case IrOp::IfGeq:
+        case IrOp::IfEqInteger:
+        case IrOp::IfClosureOf:
+        case IrOp::Return:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool irIsPure(instptr_t inst) {
+    switch (inst->op) {
+        case IrOp::LoadConst:
+        case IrOp::LoadFunc:
+        case IrOp::StoreLocal:
+        case IrOp::PushFreeRef:
+        case IrOp::PushClosureRef:
+        case IrOp::LoadReference:
+        case IrOp::LazyLocalRef:
+        case IrOp::Sub:
+        case IrOp::Mul:
+        case IrOp::AddInteger:
+        case IrOp::Neg:
+        case IrOp::Gt:
+        case IrOp::Geq:
+        case IrOp::EqInteger:
+        case IrOp::And:
+        case IrOp::Or:
+        case IrOp::Not:
+        case IrOp::UnboxInteger:
+        case IrOp::UnboxBoolean:
+        case IrOp::NewInteger:
+        case IrOp::NewBoolean:
+        case IrOp::Phi:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/************************
+ * CONSTRUCTION
+ ***********************/
+Cfg::Cfg(IrFunc* irFunc) {
+    func = irFunc;
+    build();
+    removeUnreachable();
+    computeDominators();
+    computeFrontiers();
+}
+
+void Cfg::addEdge(BasicBlock* from, BasicBlock* to) {
+    if (find(from->succs.begin(), from->succs.end(), to) != from->succs.end()) {
+        return;  // e.g. a branch to the next block
+    }
+    from->succs.push_back(to);
+    to->preds.push_back(from);
+}
+
+void Cfg::build() {
+    BasicBlock* current = nullptr;
+    // keep the entry free of preds, so the prolog is its only way in
+    if (func->instructions.size() > 0 &&
+            func->instructions.front()->op == IrOp::AddLabel) {
+        blocks.push_back(make_shared<BasicBlock>(0));
+    }
+    for (instptr_t inst : func->instructions) {
+        bool startsBlock = inst->op == IrOp::AddLabel &&
+            current && !current->instructions.empty() &&
+            current->instructions.back()->op != IrOp::AddLabel;
+        if (!current || startsBlock) {
+            blocks.push_back(make_shared<BasicBlock>(blocks.size()));
+            current = blocks.back().get();
+        }
+        if (inst->op == IrOp::AddLabel) {
+            labelBlocks[inst->op0.value()] = current;
+        }
+        current->instructions.push_back(inst);
+        if (irIsJump(inst)) {
+            current = nullptr;
+        }
+    }
+    for (int i = 0; i < blocks.size(); i++) {
+        BasicBlock* block = blocks.at(i).get();
+        BasicBlock* next = i + 1 < blocks.size() ? blocks.at(i + 1).get() : nullptr;
+        if (block->instructions.empty()) {
+            if (next) {
+                addEdge(block, next);
+            }
+            continue;
+        }
+        instptr_t last = block->instructions.back();
+        switch (last->op) {
+            case IrOp::Return:
+                break;
+            case IrOp::Goto:
+                addEdge(block, labelBlocks.at(last->op0.value()));
+                break;
+            case IrOp::If:
+            case IrOp::IfGt:
+            case IrOp::IfGeq:
+            case IrOp::IfEqInteger:
+            case IrOp::IfClosureOf:
+                addEdge(block, labelBlocks.at(last->op0.value()));
+                // fall through to the next block too
+            default:
+                if (next) {
+                    addEdge(block, next);
+                }
+        }
+    }
+}
+
+void Cfg::removePred(BasicBlock* block, int predIndex) {
+    block->preds.erase(block->preds.begin() + predIndex);
+    for (instptr_t phi : block->phis) {
+        phi->tempIndices->erase(phi->tempIndices->begin() + 1 + predIndex);
+    }
+}
+
+void Cfg::removeEdge(BasicBlock* from, BasicBlock* to) {
+    from->succs.erase(find(from->succs.begin(), from->succs.end(), to));
+    removePred(to, find(to->preds.begin(), to->preds.end(), from) - to->preds.begin());
+}
+
+void Cfg::update() {
+    removeUnreachable();
+    computeDominators();
+    computeFrontiers();
+}
+
+int Cfg::removeDeadCode() {
+    int removed = 0;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        map<int, int> useCounts;
+        for (blockptr_t block : blocks) {
+            for (IrInstList* insts : {&block->phis, &block->instructions}) {
+                for (instptr_t inst : *insts) {
+                    for (tempptr_t use : irUses(func, inst)) {
+                        useCounts[use->index]++;
+                    }
+                }
+            }
+        }
+        for (blockptr_t block : blocks) {
+            for (IrInstList* insts : {&block->phis, &block->instructions}) {
+                for (auto it = insts->begin(); it != insts->end();) {
+                    opttemp_t def = irDef(*it);
+                    if (def && irIsPure(*it) && useCounts[def.value()->index] == 0) {
+                        it = insts->erase(it);
+                        changed = true;
+                        removed++;
+                    } else {
+                        it++;
+                    }
+                }
+            }
+        }
+    }
+    return removed;
+}
+
+void Cfg::replace(tempptr_t temp, tempptr_t with) {
+    replacements[temp->index] = with;
+}
+
+tempptr_t Cfg::replacement(tempptr_t temp) {
+    auto it = replacements.find(temp->index);
+    while (it != replacements.end()) {
+        temp = it->second;
+        it = replacements.find(temp->index);
+    }
+    return temp;
+}
+
+tempptr_t Cfg::copySource(tempptr_t temp, map<int, instptr_t>& defs) {
+    temp = replacement(temp);
+    auto it = defs.find(temp->index);
+    while (it != defs.end() && it->second->op == IrOp::StoreLocal) {
+        temp = replacement(it->second->tempIndices->at(1));
+        it = defs.find(temp->index);
+    }
+    return temp;
+}
+
+void Cfg::replaceUses() {
+    for (blockptr_t block : blocks) {
+        for (IrInstList* insts : {&block->phis, &block->instructions}) {
+            for (instptr_t inst : *insts) {
+                for (tempptr_t& temp : *inst->tempIndices) {
+                    temp = replacement(temp);
+                }
+            }
+        }
+    }
+    for (DeoptPoint* point : func->deoptPoints) {
+        for (TempList* temps : {&point->locals, &point->stack}) {
+            for (tempptr_t& temp : *temps) {
+                temp = replacement(temp);
+            }
+        }
+    }
+    replacements.clear();
+}
+
+void Cfg::removeUnreachable() {
+    if (blocks.empty()) {
+        return;
+    }
+    // depth first search from the entry, recording the postorder
+    postorder.clear();
+    set<BasicBlock*> visited;
+    vector<pair<BasicBlock*, int>> stack = {{blocks.front().get(), 0}};
+    visited.insert(blocks.front().get());
+    while (!stack.empty()) {
+        BasicBlock* block = stack.back().first;
+        int next = stack.back().second;
+        if (next < block->succs.size()) {
+            stack.back().second++;
+            BasicBlock* succ = block->succs.at(next);
+            if (visited.count(succ) == 0) {
+                visited.insert(succ);
+                stack.push_back({succ, 0});
+            }
+        } else {
+            postorder.push_back(block);
+            stack.pop_back();
+        }
+    }
+    vector<blockptr_t> reachable;
+    for (blockptr_t block : blocks) {
+        if (visited.count(block.get()) == 0) {
+            continue;
+        }
+        for (int i = block->preds.size() - 1; i >= 0; i--) {
+            if (visited.count(block->preds.at(i)) == 0) {
+                removePred(block.get(), i);
+            }
+        }
+        block->index = reachable.size();
+        reachable.push_back(block);
+    }
+    for (auto it = labelBlocks.begin(); it != labelBlocks.end();) {
+        if (visited.count(it->second) == 0) {
+            it = labelBlocks.erase(it);
+        } else {
+            it++;
+        }
+    }
+    blocks = reachable;
+}
+
+vector<BasicBlock*> Cfg::reversePostorder() {
+    return vector<BasicBlock*>(postorder.rbegin(), postorder.rend());
+}
+
+/************************
+ * DOMINATORS
+ ***********************/
+void Cfg::computeDominators() {
+    // Cooper, Harvey and Kennedy's iterative algorithm
+    if (blocks.empty()) {
+        return;
+    }
+    vector<BasicBlock*> rpo = reversePostorder();
+    map<BasicBlock*, int> order;
+    for (int i = 0; i < rpo.size(); i++) {
+        order[rpo.at(i)] = i;
+    }
+    for (blockptr_t block : blocks) {
+        block->idom = nullptr;
+        block->domChildren.clear();
+    }
+    BasicBlock* entry = blocks.front().get();
+    entry->idom = entry;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (BasicBlock* block : rpo) {
+            if (block == entry) {
+                continue;
+            }
+            BasicBlock* newIdom = nullptr;
+            for (BasicBlock* pred : block->preds) {
+                if (!pred->idom) {
+                    continue;  // not processed yet
+                }
+                if (!newIdom) {
+                    newIdom = pred;
+                    continue;
+                }
+                // walk both up the tree until they meet
+                BasicBlock* a = pred;
+                BasicBlock* b = newIdom;
+                while (a != b) {
+                    while (order.at(a) > order.at(b)) {
+                        a = a->idom;
+                    }
+                    while (order.at(b) > order.at(a)) {
+                        b = b->idom;
+                    }
+                }
+                newIdom = a;
+            }
+            if (block->idom != newIdom) {
+                block->idom = newIdom;
+                changed = true;
+            }
+        }
+    }
+    entry->idom = nullptr;
+    for (BasicBlock* block : rpo) {
+        if (block->idom) {
+            block->idom->domChildren.push_back(block);
+        }
+    }
+}
+
+void Cfg::computeFrontiers() {
+    for (blockptr_t block : blocks) {
+        block->frontier.clear();
+    }
+    for (blockptr_t block : blocks) {
+        if (block->preds.size() < 2) {
+            continue;
+        }
+        for (BasicBlock* pred : block->preds) {
+            BasicBlock* runner = pred;
+            while (runner && runner != block->idom) {
+                runner->frontier.insert(block.get());
+                runner = runner->idom;
+            }
+        }
+    }
+}
+
+bool Cfg::dominates(BasicBlock* a, BasicBlock* b) {
+    for (BasicBlock* runner = b; runner; runner = runner->idom) {
+        if (runner == a) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/************************
+ * LIVENESS
+ ***********************/
+void Cfg::computeLiveness() {
+    assert (!inSsa);
+    map<BasicBlock*, set<int>> uses;
+    map<BasicBlock*, set<int>> defs;
+    for (blockptr_t block : blocks) {
+        set<int>& blockUses = uses[block.get()];
+        set<int>& blockDefs = defs[block.get()];
+        for (instptr_t inst : block->instructions) {
+            for (tempptr_t t : irUses(func, inst)) {
+                if (blockDefs.count(t->index) == 0) {
+                    blockUses.insert(t->index);
+                }
+            }
+            opttemp_t def = irDef(inst);
+            if (def) {
+                blockDefs.insert(def.value()->index);
+            }
+        }
+        block->liveIn.clear();
+        block->liveOut.clear();
+    }
+    // postorder visits successors first, so this converges quickly
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (BasicBlock* block : postorder) {
+            set<int> liveOut;
+            for (BasicBlock* succ : block->succs) {
+                liveOut.insert(succ->liveIn.begin(), succ->liveIn.end());
+            }
+            set<int> liveIn = uses.at(block);
+            for (int t : liveOut) {
+                if (defs.at(block).count(t) == 0) {
+                    liveIn.insert(t);
+                }
+            }
+            if (liveIn != block->liveIn || liveOut != block->liveOut) {
+                block->liveIn = liveIn;
+                block->liveOut = liveOut;
+                changed = true;
+            }
+        }
+    }
+}
+
+void Cfg::computeLiveIntervals() {
+    computeLiveness();
+    for (tempptr_t t : func->temps) {
+        t->startInterval = -1;
+        t->endInterval = -1;
+        t->ranges.clear();
+    }
+    auto extend = [](tempptr_t t, int pos) {
+        if (t->startInterval == -1 && t->endInterval == -1) {
+            t->startInterval = pos;
+            t->endInterval = pos;
+        } else {
+            t->startInterval = min(t->startInterval, pos);
+            t->endInterval = max(t->endInterval, pos);
+        }
+    };
+    int pos = 0;
+    for (blockptr_t block : blocks) {
+        if (block->instructions.empty()) {
+            continue;
+        }
+        int first = pos;
+        int last = pos + block->instructions.size() - 1;
+        map<int, pair<int, int>> ranges;  // temp index -> range in this block
+        auto live = [&](tempptr_t t, int at) {
+            extend(t, at);
+            auto it = ranges.find(t->index);
+            if (it == ranges.end()) {
+                ranges[t->index] = {at, at};
+            } else {
+                it->second.second = max(it->second.second, at);
+            }
+        };
+        for (int t : block->liveIn) {
+            live(func->temps.at(t), first);
+        }
+        for (instptr_t inst : block->instructions) {
+            for (tempptr_t t : irUses(func, inst)) {
+                live(t, pos);
+            }
+            opttemp_t def = irDef(inst);
+            if (def) {
+                live(def.value(), pos);
+            }
+            pos++;
+        }
+        for (int t : block->liveOut) {
+            live(func->temps.at(t), last);
+        }
+        for (auto& range : ranges) {
+            func->temps.at(range.first)->ranges.push_back(range.second);
+        }
+    }
+    // the prolog sets up every local before the first instruction, so the
+    // ones that are used can't share a register with each other
+    for (int i = 0; i < func->local_count_; i++) {
+        tempptr_t local = func->temps.at(i);
+        if (local->endInterval != -1) {
+            local->startInterval = -1;
+            local->ranges.insert(local->ranges.begin(), {-1, -1});
+        }
+    }
+}
+
+void Cfg::computeLoopDepths() {
+    // the blocks of the natural loop of each back edge, by loop header
+    map<BasicBlock*, set<BasicBlock*>> loops;
+    for (blockptr_t block : blocks) {
+        for (BasicBlock* succ : block->succs) {
+            if (!dominates(succ, block.get())) {
+                continue;
+            }
+            set<BasicBlock*>& body = loops[succ];
+            body.insert(succ);
+            vector<BasicBlock*> work = {block.get()};
+            while (!work.empty()) {
+                BasicBlock* b = work.back();
+                work.pop_back();
+                if (body.insert(b).second) {
+                    work.insert(work.end(), b->preds.begin(), b->preds.end());
+                }
+            }
+        }
+    }
+    for (blockptr_t block : blocks) {
+        block->loopDepth = 0;
+    }
+    for (auto& loop : loops) {
+        for (BasicBlock* block : loop.second) {
+            block->loopDepth++;
+        }
+    }
+}
+
+/************************
+ * SSA
+ ***********************/
+tempptr_t Cfg::newTemp() {
+    tempptr_t t = make_shared<Temp>(func->temps.size());
+    func->temps.push_back(t);
+    return t;
+}
+
+void Cfg::toSsa() {
+    if (blocks.empty()) {
+        return;
+    }
+    // the locals that get reassigned; everything else is already only
+    // assigned once
+    set<int> vars;
+    for (blockptr_t block : blocks) {
+        for (instptr_t inst : block->instructions) {
+            if (inst->op == IrOp::StoreLocal) {
+                vars.insert(inst->tempIndices->at(0)->index);
+            }
+        }
+    }
+    computeLiveness();
+    placePhis(vars);
+    // the temp of each local holds the value the prolog gave it
+    map<int, vector<tempptr_t>> versions;
+    for (int v : vars) {
+        versions[v].push_back(func->temps.at(v));
+    }
+    rename(blocks.front().get(), versions);
+    inSsa = true;
+}
+
+void Cfg::placePhis(set<int>& vars) {
+    for (int v : vars) {
+        set<BasicBlock*> defSites;
+        for (blockptr_t block : blocks) {
+            for (instptr_t inst : block->instructions) {
+                if (inst->op == IrOp::StoreLocal && inst->tempIndices->at(0)->index == v) {
+                    defSites.insert(block.get());
+                }
+            }
+        }
+        vector<BasicBlock*> worklist(defSites.begin(), defSites.end());
+        set<BasicBlock*> hasPhi;
+        while (!worklist.empty()) {
+            BasicBlock* block = worklist.back();
+            worklist.pop_back();
+            for (BasicBlock* join : block->frontier) {
+                // no phi is needed where the local is dead
+                if (hasPhi.count(join) || join->liveIn.count(v) == 0) {
+                    continue;
+                }
+                tempptr_t local = func->temps.at(v);
+                TempListPtr temps = make_shared<TempList>(join->preds.size() + 1, local);
+                join->phis.push_back(make_shared<IrInstruction>(IrOp::Phi, v, temps));
+                hasPhi.insert(join);
+                if (defSites.count(join) == 0) {
+                    worklist.push_back(join);
+                }
+            }
+        }
+    }
+}
+
+void Cfg::rename(BasicBlock* block, map<int, vector<tempptr_t>>& versions) {
+    map<int, int> pushed;
+    auto current = [&versions](tempptr_t t) {
+        auto it = versions.find(t->index);
+        return it == versions.end() ? t : it->second.back();
+    };
+    for (instptr_t phi : block->phis) {
+        int v = phi->op0.value();
+        tempptr_t t = newTemp();
+        phi->tempIndices->at(0) = t;
+        versions[v].push_back(t);
+        pushed[v]++;
+    }
+    for (instptr_t inst : block->instructions) {
+        int first = irDef(inst) ? 1 : 0;
+        for (int i = first; i < inst->tempIndices->size(); i++) {
+            inst->tempIndices->at(i) = current(inst->tempIndices->at(i));
+        }
+        if (inst->op == IrOp::GuardInteger) {
+            DeoptPoint* point = func->deoptPoints.at(inst->op0.value());
+            for (tempptr_t& t : point->locals) {
+                t = current(t);
+            }
+            for (tempptr_t& t : point->stack) {
+                t = current(t);
+            }
+        }
+        if (inst->op == IrOp::StoreLocal) {
+            int v = inst->tempIndices->at(0)->index;
+            tempptr_t t = newTemp();
+            inst->tempIndices->at(0) = t;
+            versions[v].push_back(t);
+            pushed[v]++;
+        }
+    }
+    for (BasicBlock* succ : block->succs) {
+        int predIndex = find(succ->preds.begin(), succ->preds.end(), block) - succ->preds.begin();
+        for (instptr_t phi : succ->phis) {
+            phi->tempIndices->at(1 + predIndex) = versions.at(phi->op0.value()).back();
+        }
+    }
+    for (BasicBlock* child : block->domChildren) {
+        rename(child, versions);
+    }
+    for (auto& p : pushed) {
+        vector<tempptr_t>& stack = versions.at(p.first);
+        stack.resize(stack.size() - p.second);
+    }
+}
+
+void Cfg::fromSsa() {
+    // each phi gets a fresh temp that every predecessor copies its value
+    // into, and the block copies out of at its start. copying through a
+    // temp that nothing else uses keeps phis that read each other correct
+    for (blockptr_t block : blocks) {
+        IrInstList copies;
+        for (instptr_t phi : block->phis) {
+            tempptr_t merged = newTemp();
+            for (int i = 0; i < block->preds.size(); i++) {
+                BasicBlock* pred = block->preds.at(i);
+                instptr_t copy = make_shared<IrInstruction>(
+                        IrOp::StoreLocal, merged, phi->tempIndices->at(1 + i));
+                IrInstList& insts = pred->instructions;
+                if (!insts.empty() && irIsJump(insts.back())) {
+                    insts.insert(insts.end() - 1, copy);
+                } else {
+                    insts.push_back(copy);
+                }
+            }
+            copies.push_back(make_shared<IrInstruction>(
+                        IrOp::StoreLocal, phi->tempIndices->at(0), merged));
+        }
+        block->phis.clear();
+        IrInstList& insts = block->instructions;
+        auto afterLabels = insts.begin();
+        while (afterLabels != insts.end() && (*afterLabels)->op == IrOp::AddLabel) {
+            afterLabels++;
+        }
+        insts.insert(afterLabels, copies.begin(), copies.end());
+    }
+    inSsa = false;
+    linearize();
+}
+
+void Cfg::linearize() {
+    assert (!inSsa);
+    IrInstList instructions;
+    for (blockptr_t block : blocks) {
+        instructions.insert(instructions.end(),
+                block->instructions.begin(), block->instructions.end());
+    }
+    func->instructions = instructions;
+}
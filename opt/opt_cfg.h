@@ -0,0 +1,107 @@
+# pragma once
+# include "../ir.h"
+# include <map>
+# include <memory>
+# include <set>
+# include <vector>
+
+struct BasicBlock;
+typedef shared_ptr<BasicBlock> blockptr_t;
+
+// A straight-line run of ir instructions. Only the last instruction can
+// jump, and only the first can be a label.
+struct BasicBlock {
+    int index;  // position in Cfg::blocks
+    IrInstList phis;  // Phi instructions; only non-empty in ssa form
+    IrInstList instructions;
+    vector<BasicBlock*> preds;
+    vector<BasicBlock*> succs;
+    // dominator tree
+    BasicBlock* idom = nullptr;
+    vector<BasicBlock*> domChildren;
+    set<BasicBlock*> frontier;
+    // liveness, as temp indices
+    set<int> liveIn;
+    set<int> liveOut;
+    int loopDepth = 0;  // how many loops the block is in
+    BasicBlock(int index): index(index) {};
+};
+
+// Control flow graph of an IrFunc. Building one drops unreachable code;
+// the instructions are written back to the function by linearize().
+//
+// toSsa() renames every local that is assigned with StoreLocal so that
+// each temp is assigned exactly once, merging values with Phi
+// instructions at join points. Locals keep their original temp as the
+// version set up by the prolog. fromSsa() replaces the phis with copies
+// and writes the instructions back.
+class Cfg {
+private:
+    IrFunc* func;
+    bool inSsa = false;
+    map<int, BasicBlock*> labelBlocks;  // label id -> block starting with it
+    map<int, tempptr_t> replacements;  // temp index -> temp to read instead
+    vector<BasicBlock*> postorder;
+
+    void build();
+    void addEdge(BasicBlock* from, BasicBlock* to);
+    void removePred(BasicBlock* block, int predIndex);
+    void removeUnreachable();
+    void computeDominators();
+    void computeFrontiers();
+    void placePhis(set<int>& vars);
+    void rename(BasicBlock* block, map<int, vector<tempptr_t>>& versions);
+public:
+    vector<blockptr_t> blocks;  // in program order; blocks[0] is the entry
+
+    Cfg(IrFunc* func);
+    IrFunc* getFunc() { return func; }
+    bool isSsa() { return inSsa; }
+    bool dominates(BasicBlock* a, BasicBlock* b);
+    BasicBlock* labelBlock(int label) { return labelBlocks.at(label); }
+    // removes a control flow edge, along with its operands in the phis of
+    // to; call update() once done changing edges
+    void removeEdge(BasicBlock* from, BasicBlock* to);
+    // drops blocks that became unreachable and recomputes the dominators
+    void update();
+    // drops pure instructions whose results are never read, returning how
+    // many went
+    int removeDeadCode();
+    // makes reads of temp read with instead; call replaceUses() once done
+    // replacing
+    void replace(tempptr_t temp, tempptr_t with);
+    // the temp read in place of temp so far
+    tempptr_t replacement(tempptr_t temp);
+    // the temp whose value temp holds, after replacements and looking
+    // through the StoreLocal copies among defs (temp index -> definition)
+    tempptr_t copySource(tempptr_t temp, map<int, instptr_t>& defs);
+    // rewrites every read of a replaced temp, deopt points included
+    void replaceUses();
+    // blocks ordered so that each comes before its successors, ignoring
+    // back edges
+    vector<BasicBlock*> reversePostorder();
+    // fills in liveIn and liveOut for each block; not valid in ssa form
+    void computeLiveness();
+    // sets the live interval and ranges of every temp from the block
+    // liveness, over the current instruction order
+    void computeLiveIntervals();
+    // fills in loopDepth for each block, from the back edges
+    void computeLoopDepths();
+    void toSsa();
+    void fromSsa();
+    // writes the blocks back to the function's instruction list
+    void linearize();
+    tempptr_t newTemp();
+};
+
+// the temp assigned by an instruction, if any
+opttemp_t irDef(instptr_t inst);
+// the temps read by an instruction, including the vm state a guard needs
+// if it deoptimizes
+TempList irUses(IrFunc* func, instptr_t inst);
+// true if the instruction can transfer control somewhere other than the
+// next instruction
+bool irIsJump(instptr_t inst);
+// true if the instruction has no effect besides assigning its temp, so it
+// can go when nothing reads that
+bool irIsPure(instptr_t inst);
@@ -0,0 +1,155 @@
+#include "opt_escape.h"
+#include <cassert>
+
+void EscapeOpt::findUses() {
+    uses.clear();
+    for (blockptr_t block : cfg->blocks) {
+        for (IrInstList* insts : {&block->phis, &block->instructions}) {
+            for (instptr_t inst : *insts) {
+                for (tempptr_t t : irUses(func, inst)) {
+                    uses[t->index].push_back({block.get(), inst});
+                }
+            }
+        }
+    }
+}
+
+bool EscapeOpt::holders(instptr_t alloc, set<int>& temps) {
+    vector<int> work = {alloc->tempIndices->at(0)->index};
+    temps.insert(work.back());
+    while (!work.empty()) {
+        int index = work.back();
+        work.pop_back();
+        for (pair<BasicBlock*, instptr_t>& use : uses[index]) {
+            instptr_t inst = use.second;
+            TempListPtr ts = inst->tempIndices;
+            switch (inst->op) {
+                case IrOp::StoreLocal:
+                    if (temps.insert(ts->at(0)->index).second) {
+                        work.push_back(ts->at(0)->index);
+                    }
+                    break;
+                case IrOp::FieldLoad:
+                case IrOp::AssertRecord:
+                    break;
+                case IrOp::FieldStore:
+                    // stored as the value of a field, in this record or
+                    // another
+                    if (ts->at(1)->index == index || temps.count(ts->at(1)->index) > 0) {
+                        return false;
+                    }
+                    break;
+                default:
+                    return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool EscapeOpt::replace(BasicBlock* block, instptr_t alloc) {
+    set<int> temps;
+    if (!holders(alloc, temps)) {
+        return false;
+    }
+    // every store has to be in this block, after the allocation
+    set<instptr_t> afterAlloc;
+    bool seen = false;
+    for (instptr_t inst : block->instructions) {
+        seen = seen || inst == alloc;
+        if (seen) {
+            afterAlloc.insert(inst);
+        }
+    }
+    for (int index : temps) {
+        for (pair<BasicBlock*, instptr_t>& use : uses[index]) {
+            instptr_t inst = use.second;
+            if (inst->op != IrOp::FieldStore) {
+                continue;
+            }
+            if (afterAlloc.count(inst) == 0) {
+                return false;
+            }
+        }
+    }
+    // loads in this block read the value stored before them; anywhere
+    // else, the one the block left
+    map<string, tempptr_t> fields;  // field name -> value stored last
+    map<instptr_t, tempptr_t> loaded;
+    for (instptr_t inst : block->instructions) {
+        if (afterAlloc.count(inst) == 0) {
+            continue;
+        }
+        TempListPtr ts = inst->tempIndices;
+        if (inst->op == IrOp::FieldStore && temps.count(ts->at(0)->index) > 0) {
+            fields[inst->name0.value()] = ts->at(1);
+        } else if (inst->op == IrOp::FieldLoad && temps.count(ts->at(1)->index) > 0) {
+            auto field = fields.find(inst->name0.value());
+            if (field == fields.end()) {
+                return false;
+            }
+            loaded[inst] = field->second;
+        }
+    }
+    for (int index : temps) {
+        for (pair<BasicBlock*, instptr_t>& use : uses[index]) {
+            instptr_t inst = use.second;
+            if (inst->op != IrOp::FieldLoad || loaded.count(inst) > 0) {
+                continue;
+            }
+            auto field = fields.find(inst->name0.value());
+            if (use.first == block || field == fields.end()) {
+                // read before the allocation, around a loop
+                return false;
+            }
+            loaded[inst] = field->second;
+        }
+    }
+    // the loads become copies of the field values, and the rest goes
+    for (auto& load : loaded) {
+        instptr_t inst = load.first;
+        inst->op = IrOp::StoreLocal;
+        inst->name0 = nullopt;
+        inst->tempIndices = make_shared<TempList>(
+                TempList{inst->tempIndices->at(0), load.second});
+    }
+    for (blockptr_t b : cfg->blocks) {
+        IrInstList kept;
+        for (instptr_t inst : b->instructions) {
+            bool onRecord = (inst->op == IrOp::FieldStore || inst->op == IrOp::AssertRecord ||
+                    inst->op == IrOp::StoreLocal) &&
+                temps.count(inst->tempIndices->at(0)->index) > 0;
+            if (inst != alloc && !onRecord) {
+                kept.push_back(inst);
+            }
+        }
+        b->instructions = kept;
+    }
+    return true;
+}
+
+int EscapeOpt::optimize(IrFunc* irFunc) {
+    func = irFunc;
+    cfg = irFunc->cfg;
+    if (cfg->blocks.empty()) {
+        return 0;
+    }
+    assert (cfg->isSsa());
+    int replaced = 0;
+    for (blockptr_t block : cfg->blocks) {
+        IrInstList allocs;
+        for (instptr_t inst : block->instructions) {
+            if (inst->op == IrOp::AllocRecord) {
+                allocs.push_back(inst);
+            }
+        }
+        for (instptr_t alloc : allocs) {
+            // replacing one changes what reads the others
+            findUses();
+            if (replace(block.get(), alloc)) {
+                replaced++;
+            }
+        }
+    }
+    return replaced + cfg->removeDeadCode();
+}
@@ -0,0 +1,21 @@
+# pragma once
+#include "opt.h"
+#include "opt_cfg.h"
+#include <map>
+#include <set>
+#include <string>
+
+// Scalar replacement of records that never leave the function, over the
+// ssa form
+class EscapeOpt : public IrOpt {
+private:
+    Cfg* cfg;
+    map<int, vector<pair<BasicBlock*, instptr_t>>> uses;  // temp index -> readers
+
+    void findUses();
+    // the temps holding the record alloc defines, if it doesn't escape
+    bool holders(instptr_t alloc, set<int>& temps);
+    bool replace(BasicBlock* block, instptr_t alloc);
+public:
+    int optimize(IrFunc* irFunc) override;
+};
@@ -0,0 +1,34 @@
+#include "opt_global.h"
+#include "../vm/interpreter.h"
+
+int GlobalConstOpt::optimize(IrFunc* irFunc) {
+    func = irFunc;
+    set<string> stored;
+    for (instptr_t inst : func->instructions) {
+        if (inst->op == IrOp::StoreGlobal) {
+            stored.insert(inst->name0.value());
+        }
+    }
+    int replaced = 0;
+    for (instptr_t inst : func->instructions) {
+        if (inst->op != IrOp::LoadGlobal) {
+            continue;
+        }
+        string name = inst->name0.value();
+        int slot = vm->globalSlots.at(name);
+        tagptr_t val = vm->globalCells[slot]->ptr;
+        // the top level never runs inside a call, so when it changes a
+        // global no compiled code that read it is running
+        if (stored.count(name) > 0 || effects->globals.count(name) > 0 ||
+                vm->unstableGlobals.count(slot) > 0 || val == NULL_PTR) {
+            continue;
+        }
+        inst->op = IrOp::LoadConst;
+        inst->op0 = func->constantIndex(val);
+        inst->name0 = nullopt;
+        vm->globalDependents[slot].insert(compiled);
+        vm->watchedGlobals[slot] = 1;
+        replaced++;
+    }
+    return replaced;
+}
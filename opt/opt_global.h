@@ -0,0 +1,23 @@
+# pragma once
+#include "opt.h"
+#include "opt_licm.h"
+#include "../frame.h"
+#include <set>
+#include <string>
+
+class Interpreter;
+
+// Reads globals only the top level stores to as constants; runs before
+// the cfg is built
+class GlobalConstOpt : public IrOpt {
+private:
+    Interpreter* vm;
+    Function* compiled;
+    CallEffects* effects;
+public:
+    GlobalConstOpt(Interpreter* vm, Function* compiled, CallEffects* effects):
+        vm(vm),
+        compiled(compiled),
+        effects(effects) {};
+    int optimize(IrFunc* irFunc) override;
+};
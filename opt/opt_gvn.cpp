@@ -0,0 +1,167 @@
+#include "opt_gvn.h"
+#include <cassert>
+
+static bool isValue(instptr_t inst) {
+    // constants are cheaper to load again than to keep in a register
+    switch (inst->op) {
+        case IrOp::PushFreeRef:
+        case IrOp::PushClosureRef:
+        case IrOp::Sub:
+        case IrOp::Mul:
+        case IrOp::AddInteger:
+        case IrOp::Neg:
+        case IrOp::Gt:
+        case IrOp::Geq:
+        case IrOp::EqInteger:
+        case IrOp::And:
+        case IrOp::Or:
+        case IrOp::Not:
+        case IrOp::UnboxInteger:
+        case IrOp::UnboxBoolean:
+        case IrOp::NewInteger:
+        case IrOp::NewBoolean:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool isLoad(instptr_t inst) {
+    switch (inst->op) {
+        case IrOp::LoadGlobal:
+        case IrOp::LoadReference:
+        case IrOp::FieldLoad:
+        case IrOp::IndexLoad:
+        case IrOp::CastString:
+            return true;
+        default:
+            return false;
+    }
+}
+
+ValueKey GvnOpt::key(instptr_t inst) {
+    vector<int> operands;
+    for (int i = 1; i < inst->tempIndices->size(); i++) {
+        operands.push_back(cfg->copySource(inst->tempIndices->at(i), copies)->index);
+    }
+    return ValueKey(inst->op,
+        inst->op0 ? inst->op0.value() : -1,
+        inst->name0 ? inst->name0.value() : "",
+        operands);
+}
+
+void GvnOpt::kill(instptr_t inst, map<ValueKey, tempptr_t>& loads) {
+    bool fields = false;  // all field loads
+    bool indices = false;  // index loads and string casts
+    set<string> fieldNames;
+    set<string> globalNames;
+    bool refs = false;
+    TempListPtr temps = inst->tempIndices;
+    switch (inst->op) {
+        case IrOp::FieldStore:
+            fieldNames.insert(inst->name0.value());
+            indices = true;
+            break;
+        case IrOp::IndexStore:
+            fields = true;
+            indices = true;
+            break;
+        case IrOp::StoreGlobal:
+            globalNames.insert(inst->name0.value());
+            break;
+        case IrOp::StoreLocalRef:
+            // an inlined closure's ref can be one of our own
+            refs = true;
+            break;
+        case IrOp::Call:
+            fields = effects->indexStores;
+            fieldNames = effects->fields;
+            indices = effects->indexStores || !effects->fields.empty();
+            globalNames = effects->globals;
+            break;
+        default:
+            return;
+    }
+    for (auto it = loads.begin(); it != loads.end();) {
+        IrOp op = get<0>(it->first);
+        const string& name = get<2>(it->first);
+        bool killed = (op == IrOp::FieldLoad && (fields || fieldNames.count(name) > 0)) ||
+            ((op == IrOp::IndexLoad || op == IrOp::CastString) && indices) ||
+            (op == IrOp::LoadGlobal && globalNames.count(name) > 0) ||
+            (op == IrOp::LoadReference && refs);
+        it = killed ? loads.erase(it) : next(it);
+    }
+    // loads of what was just stored read the value stored
+    switch (inst->op) {
+        case IrOp::FieldStore:
+            loads[ValueKey(IrOp::FieldLoad, -1, inst->name0.value(),
+                {cfg->copySource(temps->at(0), copies)->index})] =
+                cfg->replacement(temps->at(1));
+            break;
+        case IrOp::IndexStore:
+            loads[ValueKey(IrOp::IndexLoad, -1, "",
+                {cfg->copySource(temps->at(0), copies)->index,
+                    cfg->copySource(temps->at(2), copies)->index})] =
+                cfg->replacement(temps->at(1));
+            break;
+        case IrOp::StoreGlobal:
+            loads[ValueKey(IrOp::LoadGlobal, -1, inst->name0.value(), {})] =
+                cfg->replacement(temps->at(0));
+            break;
+        case IrOp::StoreLocalRef:
+            loads[ValueKey(IrOp::LoadReference, -1, "",
+                {cfg->copySource(temps->at(0), copies)->index})] =
+                cfg->replacement(temps->at(1));
+            break;
+        default:
+            break;
+    }
+}
+
+void GvnOpt::walk(BasicBlock* block, map<ValueKey, tempptr_t> values,
+        map<ValueKey, tempptr_t> loads) {
+    IrInstList kept;
+    for (instptr_t inst : block->instructions) {
+        bool value = isValue(inst);
+        if (!value && !isLoad(inst)) {
+            kill(inst, loads);
+            kept.push_back(inst);
+            continue;
+        }
+        map<ValueKey, tempptr_t>& table = value ? values : loads;
+        ValueKey k = key(inst);
+        auto seen = table.find(k);
+        if (seen != table.end()) {
+            cfg->replace(inst->tempIndices->at(0), seen->second);
+            changes++;
+            continue;
+        }
+        table[k] = inst->tempIndices->at(0);
+        kept.push_back(inst);
+    }
+    block->instructions = kept;
+    for (BasicBlock* child : block->domChildren) {
+        // another way into the child could have stored to anything
+        bool onlyFromHere = child->preds.size() == 1;
+        walk(child, values, onlyFromHere ? loads : map<ValueKey, tempptr_t>());
+    }
+}
+
+int GvnOpt::optimize(IrFunc* irFunc) {
+    func = irFunc;
+    cfg = irFunc->cfg;
+    if (cfg->blocks.empty()) {
+        return 0;
+    }
+    assert (cfg->isSsa());
+    for (blockptr_t block : cfg->blocks) {
+        for (instptr_t inst : block->instructions) {
+            if (inst->op == IrOp::StoreLocal) {
+                copies[inst->tempIndices->at(0)->index] = inst;
+            }
+        }
+    }
+    walk(cfg->blocks.front().get(), map<ValueKey, tempptr_t>(), map<ValueKey, tempptr_t>());
+    cfg->replaceUses();
+    return changes + cfg->removeDeadCode();
+}
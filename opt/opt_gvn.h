@@ -0,0 +1,40 @@
+# pragma once
+#include "opt.h"
+#include "opt_cfg.h"
+#include "opt_licm.h"
+#include <map>
+#include <string>
+#include <tuple>
+
+// what an instruction computes: its op, op0, name0 and operands
+typedef tuple<IrOp, int, string, vector<int>> ValueKey;
+
+// Global value numbering over the ssa form. An instruction computing the
+// same thing as one that dominates it is dropped, and what it defined is
+// read from the earlier one instead.
+//
+// Pure instructions are reused anywhere they dominate. Loads of fields,
+// indices, globals and references, and string casts (which read the fields
+// of a record), are only reused until something might change what they
+// read: a store to the same field, global or reference, any index store,
+// or a call that can store to it. These are only carried into a block whose
+// one predecessor is the block above it in the dominator tree. A store
+// also makes the value it stores available to later loads of the same
+// place.
+class GvnOpt : public IrOpt {
+private:
+    Cfg* cfg;
+    CallEffects* effects;
+    map<int, instptr_t> copies;  // temp index -> StoreLocal defining it
+    int changes = 0;
+
+    ValueKey key(instptr_t inst);
+    // drops the loads an instruction might change what they read
+    void kill(instptr_t inst, map<ValueKey, tempptr_t>& loads);
+    // visits the dominator tree, knowing the values computed above block
+    void walk(BasicBlock* block, map<ValueKey, tempptr_t> values,
+            map<ValueKey, tempptr_t> loads);
+public:
+    GvnOpt(CallEffects* effects): effects(effects) {};
+    int optimize(IrFunc* irFunc) override;
+};
@@ -0,0 +1,189 @@
+#include "opt_induction.h"
+#include <cassert>
+
+bool InductionOpt::isIntConst(tempptr_t temp) {
+    auto def = defs.find(temp->index);
+    if (def == defs.end() || def->second->op != IrOp::LoadConst) {
+        return false;
+    }
+    tagptr_t c = func->constants_.at(def->second->op0.value());
+    return is_tagged(c) && (c & ALL_TAG) == INT_TAG;
+}
+
+bool InductionOpt::isBoxedInt(tempptr_t temp, set<instptr_t>& candidates) {
+    auto def = defs.find(temp->index);
+    return isIntConst(temp) || (def != defs.end() &&
+        (def->second->op == IrOp::NewInteger || candidates.count(def->second) > 0));
+}
+
+set<instptr_t> InductionOpt::findCandidates() {
+    set<instptr_t> candidates;
+    for (blockptr_t block : cfg->blocks) {
+        candidates.insert(block->phis.begin(), block->phis.end());
+        for (instptr_t inst : block->instructions) {
+            if (inst->op == IrOp::Add) {
+                candidates.insert(inst);
+            }
+        }
+    }
+    // start out with every phi and add, to see through loops, and drop the
+    // ones reading something else. what's left only ever sees ints: the
+    // first time around a loop the phis merge ints from outside it, and an
+    // add of ints is an int
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto it = candidates.begin(); it != candidates.end();) {
+            TempListPtr temps = (*it)->tempIndices;
+            bool ints = true;
+            bool allConst = true;
+            for (int i = 1; i < temps->size() && ints; i++) {
+                tempptr_t s = cfg->copySource(temps->at(i), defs);
+                ints = isBoxedInt(s, candidates);
+                allConst = allConst && isIntConst(s);
+            }
+            // merges of constants are mostly used boxed, as they were
+            if (!ints || ((*it)->op == IrOp::Phi && allConst)) {
+                it = candidates.erase(it);
+                changed = true;
+            } else {
+                it++;
+            }
+        }
+    }
+    return candidates;
+}
+
+tempptr_t InductionOpt::rawOperand(tempptr_t temp, IrInstList& unboxes) {
+    tempptr_t s = cfg->copySource(temp, defs);
+    auto unboxed = raw.find(s->index);
+    if (unboxed != raw.end()) {
+        return unboxed->second;
+    }
+    instptr_t def = defs.at(s->index);
+    if (def->op == IrOp::NewInteger) {
+        return def->tempIndices->at(1);
+    }
+    tempptr_t t = cfg->newTemp();
+    unboxes.push_back(make_shared<IrInstruction>(IrOp::UnboxInteger, t, s));
+    return t;
+}
+
+void InductionOpt::unbox(set<instptr_t>& candidates) {
+    for (instptr_t inst : candidates) {
+        raw[inst->tempIndices->at(0)->index] = cfg->newTemp();
+    }
+    for (blockptr_t block : cfg->blocks) {
+        IrInstList phis;
+        IrInstList boxes;
+        for (instptr_t phi : block->phis) {
+            if (candidates.count(phi) == 0) {
+                phis.push_back(phi);
+                continue;
+            }
+            tempptr_t boxed = phi->tempIndices->at(0);
+            tempptr_t unboxed = raw.at(boxed->index);
+            TempListPtr temps = make_shared<TempList>(TempList{unboxed});
+            for (int i = 1; i < phi->tempIndices->size(); i++) {
+                // constants are unboxed at the end of the block they come from
+                IrInstList unboxes;
+                temps->push_back(rawOperand(phi->tempIndices->at(i), unboxes));
+                IrInstList& insts = block->preds.at(i - 1)->instructions;
+                auto end = !insts.empty() && irIsJump(insts.back()) ? insts.end() - 1 : insts.end();
+                insts.insert(end, unboxes.begin(), unboxes.end());
+            }
+            phis.push_back(make_shared<IrInstruction>(IrOp::Phi, phi->op0, temps));
+            boxes.push_back(make_shared<IrInstruction>(IrOp::NewInteger, boxed, unboxed));
+            changes++;
+        }
+        block->phis = phis;
+        IrInstList insts;
+        for (instptr_t inst : block->instructions) {
+            // boxes for the phis go after the labels
+            if (inst->op != IrOp::AddLabel) {
+                insts.insert(insts.end(), boxes.begin(), boxes.end());
+                boxes.clear();
+            }
+            if (candidates.count(inst) == 0) {
+                insts.push_back(inst);
+                continue;
+            }
+            // an add of ints that adds the raw ints and boxes the sum
+            tempptr_t boxed = inst->tempIndices->at(0);
+            tempptr_t unboxed = raw.at(boxed->index);
+            TempListPtr temps = make_shared<TempList>(TempList{unboxed});
+            for (int i = 1; i < inst->tempIndices->size(); i++) {
+                temps->push_back(rawOperand(inst->tempIndices->at(i), insts));
+            }
+            insts.push_back(make_shared<IrInstruction>(IrOp::AddInteger, temps));
+            insts.push_back(make_shared<IrInstruction>(IrOp::NewInteger, boxed, unboxed));
+            changes++;
+        }
+        insts.insert(insts.end(), boxes.begin(), boxes.end());
+        block->instructions = insts;
+    }
+    for (blockptr_t block : cfg->blocks) {
+        for (instptr_t inst : block->instructions) {
+            if (inst->op == IrOp::NewInteger) {
+                defs[inst->tempIndices->at(0)->index] = inst;
+            }
+        }
+    }
+}
+
+void InductionOpt::unboxBranches() {
+    for (blockptr_t block : cfg->blocks) {
+        if (block->instructions.empty()) {
+            continue;
+        }
+        instptr_t branch = block->instructions.back();
+        if (branch->op != IrOp::IfGt && branch->op != IrOp::IfGeq &&
+                branch->op != IrOp::IfEqInteger) {
+            continue;
+        }
+        bool boxed = false;
+        for (tempptr_t t : *branch->tempIndices) {
+            auto def = defs.find(cfg->copySource(t, defs)->index);
+            boxed = boxed || (def != defs.end() && def->second->op == IrOp::NewInteger);
+        }
+        if (!boxed) {
+            continue;
+        }
+        for (tempptr_t& t : *branch->tempIndices) {
+            tempptr_t s = cfg->copySource(t, defs);
+            auto def = defs.find(s->index);
+            if (def != defs.end() && def->second->op == IrOp::NewInteger) {
+                t = def->second->tempIndices->at(1);
+                continue;
+            }
+            tempptr_t unboxed = cfg->newTemp();
+            block->instructions.insert(block->instructions.end() - 1,
+                    make_shared<IrInstruction>(IrOp::UnboxInteger, unboxed, s));
+            t = unboxed;
+        }
+        changes++;
+    }
+}
+
+int InductionOpt::optimize(IrFunc* irFunc) {
+    func = irFunc;
+    cfg = irFunc->cfg;
+    if (cfg->blocks.empty()) {
+        return 0;
+    }
+    assert (cfg->isSsa());
+    for (blockptr_t block : cfg->blocks) {
+        for (IrInstList* insts : {&block->phis, &block->instructions}) {
+            for (instptr_t inst : *insts) {
+                opttemp_t def = irDef(inst);
+                if (def) {
+                    defs[def.value()->index] = inst;
+                }
+            }
+        }
+    }
+    set<instptr_t> candidates = findCandidates();
+    unbox(candidates);
+    unboxBranches();
+    return changes + cfg->removeDeadCode();
+}
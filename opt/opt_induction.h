@@ -0,0 +1,27 @@
+# pragma once
+#include "opt.h"
+#include "opt_cfg.h"
+#include "opt_tag_ptr.h"
+#include <map>
+#include <set>
+
+// Keeps ints carried around loops unboxed, over the ssa form
+class InductionOpt : public IrOpt {
+private:
+    Cfg* cfg;
+    map<int, instptr_t> defs;  // temp index -> defining instruction
+    map<int, tempptr_t> raw;  // boxed candidate temp index -> its raw int
+    int changes = 0;
+
+    bool isIntConst(tempptr_t temp);
+    bool isBoxedInt(tempptr_t temp, set<instptr_t>& candidates);
+    // the phis and adds that only ever see boxed ints
+    set<instptr_t> findCandidates();
+    // the raw int a boxed operand holds, adding the unboxing of a constant
+    // to unboxes
+    tempptr_t rawOperand(tempptr_t temp, IrInstList& unboxes);
+    void unbox(set<instptr_t>& candidates);
+    void unboxBranches();
+public:
+    int optimize(IrFunc* irFunc) override;
+};
@@ -0,0 +1,189 @@
+#include "opt_inline.h"
+#include "opt_tag_ptr.h"
+#include "../vm/interpreter.h"
+#include <algorithm>
+
+static bool hasLabel(instptr_t inst) {
+    switch (inst->op) {
+        case IrOp::AddLabel:
+        case IrOp::Goto:
+        case IrOp::If:
+        case IrOp::IfGt:
+        case IrOp::IfGeq:
+        case IrOp::IfEqInteger:
+        case IrOp::IfClosureOf:
+            return true;
+        default:
+            return false;
+    }
+}
+
+tempptr_t InlineOpt::newTemp() {
+    tempptr_t t = make_shared<Temp>(func->temps.size());
+    func->temps.push_back(t);
+    return t;
+}
+
+Closure* InlineOpt::constantClosure(instptr_t call) {
+    // the closure called, if it's a constant, like a global read as one
+    auto def = defs.find(call->tempIndices->at(1)->index);
+    if (def == defs.end() || def->second->op != IrOp::LoadConst) {
+        return nullptr;
+    }
+    tagptr_t ptr = func->constants_.at(def->second->op0.value());
+    if (ptr == NULL_PTR || is_tagged(ptr)) {
+        return nullptr;
+    }
+    return dynamic_cast<Closure*>(get_val(ptr));
+}
+
+Function* InlineOpt::callTarget(instptr_t call) {
+    Closure* constant = constantClosure(call);
+    if (constant != NULL) {
+        return constant->func;
+    }
+    auto it = func->callTargets.find(call);
+    if (it != func->callTargets.end()) {
+        return it->second;
+    }
+    // otherwise, a call of a global can go to the closure it holds now
+    auto def = defs.find(call->tempIndices->at(1)->index);
+    if (def == defs.end() || def->second->op != IrOp::LoadGlobal) {
+        return nullptr;
+    }
+    tagptr_t ptr = vm->globalValue(def->second->name0.value());
+    if (ptr == NULL_PTR || is_tagged(ptr)) {
+        return nullptr;
+    }
+    Closure* closure = dynamic_cast<Closure*>(get_val(ptr));
+    return closure == NULL ? nullptr : closure->func;
+}
+
+bool InlineOpt::canInline(Function* target, instptr_t call) {
+    // calls with the wrong number of arguments throw, so they stay calls,
+    // as do functions whose locals are captured
+    return dynamic_cast<NativeFunction*>(target) == NULL &&
+        target != caller &&
+        target->parameter_count_ == call->op0.value() &&
+        target->local_reference_vars_.empty() &&
+        target->instructions.size() <= MAX_INLINE_SIZE;
+}
+
+void InlineOpt::inlineCall(instptr_t call, Function* target, IrInstList& out) {
+    IrCompiler irc = IrCompiler(target, vm);
+    irc.speculate = false;
+    IrFunc body = irc.toIr();
+
+    TempListPtr callTemps = call->tempIndices;
+    tempptr_t res = callTemps->at(0);
+    tempptr_t clos = callTemps->at(1);
+    int labelBase = nextLabel;
+    for (instptr_t inst : body.instructions) {
+        if (hasLabel(inst)) {
+            nextLabel = max(nextLabel, labelBase + inst->op0.value() + 1);
+        }
+    }
+    int inlineLabel = nextLabel++;
+    int doneLabel = nextLabel++;
+    int funcIndex = func->functions_.size();
+    func->functions_.push_back(target);
+    int funcOffset = func->functions_.size();
+    func->functions_.insert(func->functions_.end(),
+        body.functions_.begin(), body.functions_.end());
+
+    // the call, for closures of some other function. a constant closure
+    // is always the one inlined
+    if (constantClosure(call) == NULL) {
+        tempptr_t funcTemp = newTemp();
+        out.push_back(make_shared<IrInstruction>(IrOp::LoadFunc, funcIndex, funcTemp));
+        out.push_back(make_shared<IrInstruction>(IrOp::IfClosureOf, inlineLabel,
+            make_shared<TempList>(TempList{clos, funcTemp})));
+        tempptr_t callRes = newTemp();
+        callTemps->at(0) = callRes;
+        out.push_back(call);
+        out.push_back(make_shared<IrInstruction>(IrOp::StoreLocal, res, callRes));
+        out.push_back(make_shared<IrInstruction>(IrOp::Goto, doneLabel));
+    }
+
+    // the inlined body, with the callee's temps replaced by new ones
+    out.push_back(make_shared<IrInstruction>(IrOp::AddLabel, inlineLabel));
+    map<int, tempptr_t> temps;
+    auto mapTemp = [&](tempptr_t t) {
+        auto it = temps.find(t->index);
+        if (it != temps.end()) {
+            return it->second;
+        }
+        tempptr_t mapped = newTemp();
+        temps[t->index] = mapped;
+        return mapped;
+    };
+    tempptr_t none = newTemp();
+    out.push_back(make_shared<IrInstruction>(
+        IrOp::LoadConst, func->constantIndex(vm->NONE), none));
+    for (int i = 0; i < body.local_count_; i++) {
+        tempptr_t value = i < body.parameter_count_ ? callTemps->at(2 + i) : none;
+        out.push_back(make_shared<IrInstruction>(
+            IrOp::StoreLocal, mapTemp(body.temps.at(i)), value));
+    }
+    for (instptr_t inst : body.instructions) {
+        TempListPtr mapped = make_shared<TempList>();
+        for (tempptr_t t : *inst->tempIndices) {
+            mapped->push_back(mapTemp(t));
+        }
+        if (inst->op == IrOp::Return) {
+            out.push_back(make_shared<IrInstruction>(IrOp::StoreLocal, res, mapped->at(0)));
+            out.push_back(make_shared<IrInstruction>(IrOp::Goto, doneLabel));
+            continue;
+        }
+        // the body was built just for this call, so its instructions are
+        // reused rather than copied: they outlive the compile, and
+        // compiled code points at their names
+        inst->tempIndices = mapped;
+        if (inst->op == IrOp::LoadConst) {
+            inst->op0 = func->constantIndex(body.constants_.at(inst->op0.value()));
+        } else if (inst->op == IrOp::LoadFunc) {
+            inst->op0 = funcOffset + inst->op0.value();
+        } else if (inst->op == IrOp::PushFreeRef) {
+            inst->op = IrOp::PushClosureRef;
+            mapped->push_back(clos);
+        } else if (hasLabel(inst)) {
+            inst->op0 = labelBase + inst->op0.value();
+        }
+        out.push_back(inst);
+    }
+    // falling off the end returns None
+    out.push_back(make_shared<IrInstruction>(IrOp::StoreLocal, res, none));
+    out.push_back(make_shared<IrInstruction>(IrOp::AddLabel, doneLabel));
+}
+
+int InlineOpt::optimize(IrFunc* irFunc) {
+    func = irFunc;
+    for (instptr_t inst : func->instructions) {
+        opttemp_t def = irDef(inst);
+        // locals can be assigned more than once
+        if (def && def.value()->index >= func->local_count_) {
+            defs[def.value()->index] = inst;
+        }
+        if (hasLabel(inst)) {
+            nextLabel = max(nextLabel, inst->op0.value() + 1);
+        }
+    }
+    int budget = MAX_INLINE_BUDGET;
+    int inlined = 0;
+    IrInstList result;
+    for (instptr_t inst : func->instructions) {
+        if (inst->op == IrOp::Call) {
+            Function* target = callTarget(inst);
+            if (target != nullptr && canInline(target, inst) &&
+                    target->instructions.size() <= budget) {
+                budget -= target->instructions.size();
+                inlineCall(inst, target, result);
+                inlined++;
+                continue;
+            }
+        }
+        result.push_back(inst);
+    }
+    func->instructions = result;
+    return inlined;
+}
@@ -0,0 +1,33 @@
+# pragma once
+#include "opt.h"
+#include "opt_cfg.h"
+#include "../frame.h"
+#include <map>
+
+class Interpreter;
+
+// largest function, in bytecode instructions, that gets inlined
+#define MAX_INLINE_SIZE 40
+// most bytecode instructions inlined into one function
+#define MAX_INLINE_BUDGET 200
+
+// Inlines small functions at calls with a known target, guarded by a
+// check of the closure called; runs before the cfg is built
+class InlineOpt : public IrOpt {
+private:
+    Interpreter* vm;
+    Function* caller;
+    int nextLabel = 0;
+    map<int, instptr_t> defs;  // temp index -> instruction assigning it
+
+    Closure* constantClosure(instptr_t call);
+    Function* callTarget(instptr_t call);
+    bool canInline(Function* target, instptr_t call);
+    void inlineCall(instptr_t call, Function* target, IrInstList& out);
+    tempptr_t newTemp();
+public:
+    InlineOpt(Interpreter* vm, Function* caller):
+        vm(vm),
+        caller(caller) {};
+    int optimize(IrFunc* irFunc) override;
+};
@@ -0,0 +1,229 @@
+#include "opt_licm.h"
+#include "../vm/interpreter.h"
+#include <algorithm>
+#include <cassert>
+
+CallEffects::CallEffects(Function* mainFunc) {
+    for (Function* func : mainFunc->functions_) {
+        gather(func);
+    }
+}
+
+void CallEffects::gather(Function* func) {
+    for (BcInstruction& inst : func->instructions) {
+        switch (inst.operation) {
+            case BcOp::StoreGlobal:
+                globals.insert(func->names_.at(inst.operand0.value()));
+                break;
+            case BcOp::FieldStore:
+                fields.insert(func->names_.at(inst.operand0.value()));
+                break;
+            case BcOp::IndexStore:
+                indexStores = true;
+                break;
+            default:
+                break;
+        }
+    }
+    for (Function* inner : func->functions_) {
+        gather(inner);
+    }
+}
+
+vector<Loop> LicmOpt::findLoops() {
+    map<BasicBlock*, Loop> headers;
+    for (blockptr_t block : cfg->blocks) {
+        for (BasicBlock* succ : block->succs) {
+            if (!cfg->dominates(succ, block.get())) {
+                continue;
+            }
+            // a back edge: the loop is everything that reaches it without
+            // going through the header
+            Loop& loop = headers[succ];
+            loop.header = succ;
+            loop.blocks.insert(succ);
+            vector<BasicBlock*> work;
+            if (loop.blocks.insert(block.get()).second) {
+                work.push_back(block.get());
+            }
+            while (!work.empty()) {
+                BasicBlock* b = work.back();
+                work.pop_back();
+                for (BasicBlock* pred : b->preds) {
+                    if (loop.blocks.insert(pred).second) {
+                        work.push_back(pred);
+                    }
+                }
+            }
+        }
+    }
+    vector<Loop> loops;
+    for (auto& entry : headers) {
+        Loop& loop = entry.second;
+        vector<BasicBlock*> outside;
+        for (BasicBlock* pred : loop.header->preds) {
+            if (loop.blocks.count(pred) == 0) {
+                outside.push_back(pred);
+            }
+        }
+        // while loops are entered by a goto to the condition, which makes
+        // the block before them a preheader
+        if (outside.size() == 1 && outside.front()->succs.size() == 1) {
+            loop.preheader = outside.front();
+            loops.push_back(loop);
+        }
+    }
+    // inner loops first, so what they hoist can move further out
+    stable_sort(loops.begin(), loops.end(), [](const Loop& a, const Loop& b) {
+        return a.blocks.size() < b.blocks.size();
+    });
+    return loops;
+}
+
+bool LicmOpt::globalDefined(string& name) {
+    // globals are never undefined again, so a load of one can't throw
+    return vm->globalValue(name) != NULL_PTR;
+}
+
+int LicmOpt::hoist(Loop& loop) {
+    // what the loop defines and stores to
+    set<int> loopDefs;
+    set<string> storedGlobals;
+    set<string> storedFields;
+    set<int> storedRefs;
+    bool hasCall = false;
+    bool indexStores = false;
+    for (BasicBlock* block : loop.blocks) {
+        for (IrInstList* insts : {&block->phis, &block->instructions}) {
+            for (instptr_t inst : *insts) {
+                opttemp_t def = irDef(inst);
+                if (def) {
+                    loopDefs.insert(def.value()->index);
+                }
+                switch (inst->op) {
+                    case IrOp::Call:
+                        hasCall = true;
+                        break;
+                    case IrOp::StoreGlobal:
+                        storedGlobals.insert(inst->name0.value());
+                        break;
+                    case IrOp::FieldStore:
+                        storedFields.insert(inst->name0.value());
+                        break;
+                    case IrOp::IndexStore:
+                        indexStores = true;
+                        break;
+                    case IrOp::StoreLocalRef:
+                        storedRefs.insert(inst->tempIndices->at(0)->index);
+                        break;
+                    default:
+                        break;
+                }
+            }
+        }
+    }
+
+    auto invariant = [&](instptr_t inst, bool inPrefix) {
+        for (tempptr_t use : irUses(func, inst)) {
+            if (loopDefs.count(use->index) > 0) {
+                return false;
+            }
+        }
+        switch (inst->op) {
+            case IrOp::PushClosureRef:
+                // an inlined closure's refs are only there once the check
+                // for that closure has passed, which may be in the loop
+                return false;
+            case IrOp::LoadReference:
+                {
+                    int ref = inst->tempIndices->at(1)->index;
+                    return storedRefs.count(ref) == 0 && closureRefs.count(ref) == 0;
+                }
+            case IrOp::LoadGlobal:
+                {
+                    string& name = inst->name0.value();
+                    return storedGlobals.count(name) == 0 &&
+                        !(hasCall && effects->globals.count(name) > 0) &&
+                        globalDefined(name);
+                }
+            case IrOp::FieldLoad:
+                {
+                    string& name = inst->name0.value();
+                    return !indexStores && storedFields.count(name) == 0 &&
+                        !(hasCall && (effects->indexStores || effects->fields.count(name) > 0));
+                }
+            case IrOp::AssertInteger:
+            case IrOp::AssertBoolean:
+            case IrOp::AssertString:
+            case IrOp::AssertRecord:
+            case IrOp::AssertFunction:
+            case IrOp::AssertClosure:
+            case IrOp::AssertValWrapper:
+                // the header always runs once the loop is entered, so a
+                // check before anything with an effect there can go first
+                return inPrefix;
+            case IrOp::Phi:
+                return false;
+            default:
+                return irIsPure(inst);
+        }
+    };
+
+    int hoisted = 0;
+    IrInstList& preheader = loop.preheader->instructions;
+    for (BasicBlock* block : cfg->reversePostorder()) {
+        if (loop.blocks.count(block) == 0) {
+            continue;
+        }
+        // dominators come first, so operands are hoisted before their uses
+        bool inPrefix = block == loop.header;
+        IrInstList kept;
+        for (instptr_t inst : block->instructions) {
+            if (!invariant(inst, inPrefix)) {
+                kept.push_back(inst);
+                if (inst->op != IrOp::AddLabel && !irIsPure(inst)) {
+                    inPrefix = false;
+                }
+                continue;
+            }
+            // a load that might not have run can't throw in the preheader;
+            // it loads None from a non-record instead
+            if (inst->op == IrOp::FieldLoad && !inPrefix) {
+                inst->op0 = 1;
+            }
+            auto end = preheader.end();
+            if (!preheader.empty() && irIsJump(preheader.back())) {
+                end--;
+            }
+            preheader.insert(end, inst);
+            opttemp_t def = irDef(inst);
+            if (def) {
+                loopDefs.erase(def.value()->index);
+            }
+            hoisted++;
+        }
+        block->instructions = kept;
+    }
+    return hoisted;
+}
+
+int LicmOpt::optimize(IrFunc* irFunc) {
+    func = irFunc;
+    cfg = irFunc->cfg;
+    if (cfg->blocks.empty()) {
+        return 0;
+    }
+    assert (cfg->isSsa());
+    for (blockptr_t block : cfg->blocks) {
+        for (instptr_t inst : block->instructions) {
+            if (inst->op == IrOp::PushClosureRef) {
+                closureRefs.insert(inst->tempIndices->at(0)->index);
+            }
+        }
+    }
+    int hoisted = 0;
+    for (Loop& loop : findLoops()) {
+        hoisted += hoist(loop);
+    }
+    return hoisted;
+}
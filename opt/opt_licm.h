@@ -0,0 +1,45 @@
+# pragma once
+#include "opt.h"
+#include "opt_cfg.h"
+#include "../frame.h"
+#include <set>
+#include <string>
+
+class Interpreter;
+
+// What a call could change, gathered from the bytecode of every function
+// but the top level, which never runs inside a call. Locals can't change:
+// closures can't assign to the variables they capture.
+struct CallEffects {
+    set<string> globals;  // stored with StoreGlobal
+    set<string> fields;  // stored with FieldStore
+    bool indexStores = false;  // an IndexStore can store to any field
+    CallEffects(Function* mainFunc);
+private:
+    void gather(Function* func);
+};
+
+// A natural loop, found from a back edge to its header
+struct Loop {
+    BasicBlock* header;
+    set<BasicBlock*> blocks;
+    BasicBlock* preheader = nullptr;  // the one block entering the loop
+};
+
+// Loop-invariant code motion into loop preheaders, over the ssa form
+class LicmOpt : public IrOpt {
+private:
+    Cfg* cfg;
+    CallEffects* effects;
+    Interpreter* vm;
+    set<int> closureRefs;  // temps holding refs read out of a closure
+
+    vector<Loop> findLoops();
+    int hoist(Loop& loop);
+    bool globalDefined(string& name);
+public:
+    LicmOpt(CallEffects* effects, Interpreter* vm):
+        effects(effects),
+        vm(vm) {};
+    int optimize(IrFunc* irFunc) override;
+};
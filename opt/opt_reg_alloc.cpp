@@ -1,280 +1,283 @@
 #include "opt_reg_alloc.h"
+#include <algorithm>
+#include <cmath>
 #include <set>
 #include "include/x64asm.h"
 
 int RegOpt::optimize(IrFunc* irFunc) {
-	return linearScan(irFunc);
+	// work out the live ranges from the cfg, over the same instruction
+	// order the code generator will use
+	Cfg cfg = Cfg(irFunc);
+	cfg.linearize();
+	cfg.computeLiveIntervals();
+	cfg.computeLoopDepths();
+	map<int, double> weights = spillWeights(cfg);
+	int slots = allocate(irFunc, weights);
+	// temps left in memory can still get a register over the blocks that
+	// use them. pieces that don't get one go back, since their copies
+	// would only add memory accesses; after a few rounds all of them do
+	vector<SplitRange> ranges = split(cfg);
+	for (int round = 0; !ranges.empty(); round++) {
+		slots = reallocate(cfg);
+		vector<SplitRange> kept;
+		for (SplitRange& range : ranges) {
+			if (range.piece->reg && round < 3) {
+				kept.push_back(range);
+			} else {
+				unsplit(range);
+			}
+		}
+		if (kept.size() == ranges.size()) {
+			break;
+		}
+		ranges = kept;
+		if (ranges.empty()) {
+			slots = reallocate(cfg);
+		}
+	}
+	return slots;
 };
 
-struct compareIntervalEnd {
-	bool operator()(const tempptr_t &a, const tempptr_t &b) {
-		return a->endInterval <= b->endInterval;
-	};
-};
+int RegOpt::reallocate(Cfg& cfg) {
+	cfg.linearize();
+	cfg.computeLiveIntervals();
+	map<int, double> weights = spillWeights(cfg);
+	return allocate(cfg.getFunc(), weights);
+}
 
-int RegOpt::linearScan(IrFunc* irFunc) {
-	set<tempptr_t, compareIntervalEnd> active; // ordered by endInterval
-	int stackOffset = 0;
-	int numRegisters = freeRegisters.size();
-//	for (tempptr_t temp_i: irFunc->temps) {
-//		// modifying all regs to be long
-//		temp_i->startInterval = 0;
-//		temp_i->endInterval = irFunc->instructions.size();
-//	}
-	for (tempptr_t temp_i: irFunc->temps) {
-		if (temp_i->startInterval == -1 && temp_i->endInterval == -1) {
-			// TODO: creating global temps that do nothing
-			continue;
-		}
-		std::set<tempptr_t, compareIntervalEnd>::iterator it;
-		for (it = active.begin(); it != active.end();) { // Expire old intervals
-			tempptr_t temp_j = *it;
-			if (temp_j->endInterval >= temp_i->startInterval) {
-				break;
+map<int, double> RegOpt::spillWeights(Cfg& cfg) {
+	map<int, double> weights;
+	for (blockptr_t block : cfg.blocks) {
+		double weight = pow(10, min(block->loopDepth, 4));
+		for (instptr_t inst : block->instructions) {
+			for (tempptr_t t : irUses(cfg.getFunc(), inst)) {
+				weights[t->index] += weight;
 			}
-			if (temp_j->reg) {
-				freeRegisters.push_back(temp_j->reg.value());
+			opttemp_t def = irDef(inst);
+			if (def) {
+				weights[def.value()->index] += weight;
 			}
-			active.erase(it++);
 		}
-		if (active.size() == numRegisters) {
-			// Spill this interval
-			std::set<tempptr_t, compareIntervalEnd>::iterator end = active.end();
-			end--;
-			tempptr_t spill = *(end);
-			if (spill->endInterval > temp_i->endInterval) {
-				temp_i->reg = spill->reg;
-				spill->reg = nullopt;
-				spill->stackOffset = stackOffset;
-				stackOffset++;
-				active.insert(temp_i);
-				active.erase(end);
-			} else {
-				temp_i->stackOffset = stackOffset;
-				stackOffset++;
+	}
+	return weights;
+}
+
+// true if none of the temp's ranges overlap the ones already taken
+static bool fits(map<int, int>& taken, tempptr_t temp) {
+	for (pair<int, int>& range : temp->ranges) {
+		// taken ranges don't overlap each other, so only the last one
+		// starting in this range can reach it
+		auto it = taken.upper_bound(range.second);
+		if (it != taken.begin() && prev(it)->second >= range.first) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void take(map<int, int>& taken, tempptr_t temp) {
+	for (pair<int, int>& range : temp->ranges) {
+		taken[range.first] = range.second;
+	}
+}
+
+static bool callsHelper(instptr_t inst) {
+	switch (inst->op) {
+		case IrOp::LoadGlobal:
+		case IrOp::StoreGlobal:
+		case IrOp::StoreLocalRef:
+		case IrOp::PushClosureRef:
+		case IrOp::LoadReference:
+		case IrOp::AllocRecord:
+		case IrOp::FieldLoad:
+		case IrOp::FieldStore:
+		case IrOp::IndexLoad:
+		case IrOp::IndexStore:
+		case IrOp::AllocClosure:
+		case IrOp::Call:
+		case IrOp::AssertRecord:
+		case IrOp::AssertFunction:
+		case IrOp::AssertClosure:
+		case IrOp::AssertValWrapper:
+		case IrOp::CastString:
+		case IrOp::GarbageCollect:
+			return true;
+		default:
+			return false;
+	}
+}
+
+vector<int> RegOpt::helperCalls(IrFunc* irFunc) {
+	vector<int> calls;
+	for (int i = 0; i < irFunc->instructions.size(); i++) {
+		if (callsHelper(irFunc->instructions.at(i))) {
+			calls.push_back(i);
+		}
+	}
+	return calls;
+}
+
+// true if the temp is still needed after one of the calls
+static bool crossesCall(vector<int>& calls, tempptr_t temp) {
+	for (pair<int, int>& range : temp->ranges) {
+		auto it = upper_bound(calls.begin(), calls.end(), range.first);
+		if (it != calls.end() && *it < range.second) {
+			return true;
+		}
+	}
+	return false;
+}
+
+int RegOpt::allocate(IrFunc* irFunc, map<int, double>& weights) {
+	// temps that matter most get first pick of the registers; a temp can
+	// take a register in the gaps between the ranges of others
+	vector<tempptr_t> temps;
+	for (tempptr_t t : irFunc->temps) {
+		t->reg = nullopt;
+		t->stackOffset = nullopt;
+		if (!t->ranges.empty()) {
+			temps.push_back(t);
+		}
+	}
+	stable_sort(temps.begin(), temps.end(), [&](const tempptr_t &a, const tempptr_t &b) {
+		return weights[a->index] > weights[b->index];
+	});
+	vector<map<int, int>> regRanges(registers.size());
+	vector<map<int, int>> slotRanges;
+	vector<int> calls = helperCalls(irFunc);
+	for (tempptr_t temp : temps) {
+		// temps live across a call go in callee-saved regs where they can,
+		// the rest leave those for them
+		bool preferCalleeSaved = crossesCall(calls, temp);
+		for (bool calleeSavedPass : {preferCalleeSaved, !preferCalleeSaved}) {
+			for (int i = 0; i < registers.size() && !temp->reg; i++) {
+				if (calleeSaved.count(registers[i]) == calleeSavedPass &&
+						fits(regRanges[i], temp)) {
+					temp->reg = registers[i];
+					take(regRanges[i], temp);
+				}
 			}
-		} else {
-			// Allocate register to this temp
-			temp_i->reg = freeRegisters.back();
-			freeRegisters.pop_back();
-			active.insert(temp_i);
 		}
-		LOG(to_string(temp_i->index) + " start: " + to_string(temp_i->startInterval) + ", end: " + to_string(temp_i->endInterval));
+		if (temp->reg) {
+			continue;
+		}
+		// spilled temps share stack slots the same way
+		int slot = 0;
+		while (slot < slotRanges.size() && !fits(slotRanges[slot], temp)) {
+			slot++;
+		}
+		if (slot == slotRanges.size()) {
+			slotRanges.push_back(map<int, int>());
+		}
+		temp->stackOffset = slot;
+		take(slotRanges[slot], temp);
+		LOG(to_string(temp->index) + " spilled to slot " + to_string(slot));
 	}
-	return stackOffset;
+	return slotRanges.size();
 };
 
-void RegOpt::run() {
-    LOG("Starting reg alloc optimization");
-    if (func->instructions.size() > 0) {
-        while (!finished) {
-            executeStep();
-        }
-    }
-};
+static void renameTemp(instptr_t inst, tempptr_t from, tempptr_t to) {
+	if (find(inst->tempIndices->begin(), inst->tempIndices->end(), from) ==
+			inst->tempIndices->end()) {
+		return;
+	}
+	// instructions can share their temp lists, so this one gets its own
+	TempList temps = *inst->tempIndices;
+	replace(temps.begin(), temps.end(), from, to);
+	inst->tempIndices = make_shared<TempList>(temps);
+}
+
+// true if the instruction reads the temp itself; what a guard keeps for a
+// deopt doesn't count, since that stays with the whole temp
+static bool reads(instptr_t inst, tempptr_t temp) {
+	int first = irDef(inst) ? 1 : 0;
+	for (int i = first; i < inst->tempIndices->size(); i++) {
+		if (inst->tempIndices->at(i) == temp) {
+			return true;
+		}
+	}
+	return false;
+}
 
-void RegOpt::executeStep() {
-    instptr_t inst = func->instructions.at(instructionIndex);
-    switch(inst->op) {
-        case IrOp::LoadConst:
-            {
-                LOG(to_string(instructionIndex) + ": LoadConst");
-                break;
-            }
-        case IrOp::LoadFunc:
-            {
-                LOG(to_string(instructionIndex) + ": LoadFunc");
-                break;
-            }
-       case IrOp::LoadGlobal:
-            {
-                LOG(to_string(instructionIndex) + ": LoadGlobal");
-                break;
-            }
-        case IrOp::StoreLocal:
-            {
-                LOG(to_string(instructionIndex) + ": StoreLocal");
-                break;
-            }
-       case IrOp::StoreGlobal:
-            {
-                LOG(to_string(instructionIndex) + ": StoreGlobal");
-                break;
-            }
-		case IrOp::StoreLocalRef: 
-			{
-				LOG(to_string(instructionIndex) + ": StoreLocalRef");
-                break;
+vector<SplitRange> RegOpt::split(Cfg& cfg) {
+	IrFunc* irFunc = cfg.getFunc();
+	vector<SplitRange> ranges;
+	for (blockptr_t block : cfg.blocks) {
+		// what a piece would save for each spilled temp: a memory access
+		// per read, less a load if the block reads it before assigning it.
+		// every assignment is stored back either way, so guards and the
+		// blocks after this one see it
+		map<int, int> savings;
+		set<int> pinned;
+		for (instptr_t inst : block->instructions) {
+			opttemp_t def = irDef(inst);
+			for (int i = def ? 1 : 0; i < inst->tempIndices->size(); i++) {
+				tempptr_t t = inst->tempIndices->at(i);
+				if (!t->stackOffset) {
+					continue;
+				}
+				if (savings.count(t->index) == 0) {
+					savings[t->index] = -1;
+				}
+				savings[t->index]++;
+			}
+			if (def && def.value()->stackOffset && savings.count(def.value()->index) == 0) {
+				savings[def.value()->index] = 0;
+			}
+			if (inst->op == IrOp::BoxLocalRef) {
+				// boxing updates the ref in place, which no copy would see
+				pinned.insert(inst->tempIndices->at(0)->index);
+			}
+		}
+		for (pair<const int, int>& saving : savings) {
+			if (saving.second < 1 || pinned.count(saving.first)) {
+				continue;
+			}
+			tempptr_t temp = irFunc->temps.at(saving.first);
+			SplitRange range = {block.get(), temp, cfg.newTemp(), IrInstList()};
+			IrInstList instructions;
+			bool loaded = false;
+			for (instptr_t inst : block->instructions) {
+				opttemp_t def = irDef(inst);
+				bool assigns = def && def.value() == temp;
+				if (reads(inst, temp)) {
+					if (!loaded) {
+						instptr_t copy = make_shared<IrInstruction>(
+								IrOp::StoreLocal, range.piece, temp);
+						instructions.push_back(copy);
+						range.copies.push_back(copy);
+					}
+					renameTemp(inst, temp, range.piece);
+					loaded = true;
+				} else if (assigns) {
+					renameTemp(inst, temp, range.piece);
+				}
+				instructions.push_back(inst);
+				if (assigns) {
+					instptr_t copy = make_shared<IrInstruction>(
+							IrOp::StoreLocal, temp, range.piece);
+					instructions.push_back(copy);
+					range.copies.push_back(copy);
+					loaded = true;
+				}
 			}
-       case IrOp::PushFreeRef: 
-            {
-                LOG(to_string(instructionIndex) + ": PushFreeRef");
-                break;
-            }
-        case IrOp::LoadReference:
-            {
-                LOG(to_string(instructionIndex) + ": LoadReference");
-                break;
-            }
-        case IrOp::AllocRecord:
-            {
-                LOG(to_string(instructionIndex) + ": AllocRecord");
-                break;
-            };
-        case IrOp::FieldLoad:
-            {
-                LOG(to_string(instructionIndex) + ": FieldLoad");
-                break;
-            };
-        case IrOp::FieldStore:
-            {
-                LOG(to_string(instructionIndex) + ": FieldStore");
-                break;
-            };
-        case IrOp::IndexLoad:
-            {
-                LOG(to_string(instructionIndex) + ": IndexLoad");
-                break;
-            };
-        case IrOp::IndexStore:
-            {
-                LOG(to_string(instructionIndex) + ": IndexStore");
-                break;
-            };
-        case IrOp::AllocClosure:
-            {
-                LOG(to_string(instructionIndex) + ": AllocClosure");
-                break;
-            };
-        case IrOp::Call:
-            {
-                LOG(to_string(instructionIndex) + ": Call");
-                break;
-            };
-        case IrOp::Return:
-            {
-                LOG(to_string(instructionIndex) + ": Return");
-                break;
-            };
-        case IrOp::Add:
-            {
-                LOG(to_string(instructionIndex) + ": Add");
-                break;
-            };
-        case IrOp::Sub:
-            {
-                LOG(to_string(instructionIndex) + ": Sub");
-                break;
-            };
-        case IrOp::Mul:
-            {
-                LOG(to_string(instructionIndex) + ": Mul");
-                break;
-            };
-        case IrOp::Div:
-            {
-                LOG(to_string(instructionIndex) + ": Div");
-                break;
-            };
-        case IrOp::Neg: {
-                LOG(to_string(instructionIndex) + ": Neg");
-                break;
-            };
-        case IrOp::Gt:
-            {
-                LOG(to_string(instructionIndex) + ": Gt");
-                break;
-            };
-        case IrOp::Geq:
-            {
-                LOG(to_string(instructionIndex) + ": Geq");
-                break;
-            };
-        case IrOp::Eq:
-            {
-                LOG(to_string(instructionIndex) + ": Eq");
-                break;
-            };
-        case IrOp::And:
-            {
-                LOG(to_string(instructionIndex) + ": And");
-                break;
-            };
-        case IrOp::Or:
-            {
-                LOG(to_string(instructionIndex) + ": Or");
-                break;
-            };
-        case IrOp::Not:
-            {
-                LOG(to_string(instructionIndex) + ": Not");
-                break;
-            };
-        case IrOp::Goto:
-            {
-                LOG(to_string(instructionIndex) + ": Goto");
-                break;
-            };
-        case IrOp::If:
-            {
-                LOG(to_string(instructionIndex) + ": If");
-                break;
-            };
-       case IrOp::AssertInteger:
-            {
-                LOG(to_string(instructionIndex) + ": AssertInteger");
-                break;
-            };
-        case IrOp::AssertBoolean:
-            {
-                LOG(to_string(instructionIndex) + ": AssertBool");
-                break;
-            };
-        case IrOp::AssertString:
-            {
-                LOG(to_string(instructionIndex) + ": AssertString");
-                break;
-            };
-        case IrOp::AssertRecord:
-            {
-                LOG(to_string(instructionIndex) + ": AssertRecord");
-                break;
-            };
-        case IrOp::AssertFunction:
-            {
-                LOG(to_string(instructionIndex) + ": AssertFunction");
-                break;
-            };
-        case IrOp::AssertClosure:
-            {
-                LOG(to_string(instructionIndex) + ": AssertClosure");
-                break;
-            };
-        case IrOp::AssertValWrapper: 
-            {
-                LOG(to_string(instructionIndex) + ": AssertValWrapper");
-                break;
-            };
-        case IrOp::CastString:
-            {
-                LOG(to_string(instructionIndex) + ": CastString");
-                break;
-            };
-        case IrOp::AddLabel:
-            {
-                LOG(to_string(instructionIndex) + ": AddLabel");
-                break;
-            };
-        case IrOp::GarbageCollect:
-            {
-                LOG(to_string(instructionIndex) + ": GarbageCollect");
-                break;
-            };
-        default:
-            throw RuntimeException("Should not get here: invalid ir inst");
-    }
-    instructionIndex += 1; 
-    if (instructionIndex >= func->instructions.size()) {
-        finished = true;
-    }
+			block->instructions = instructions;
+			LOG(to_string(temp->index) + " split into " +
+					to_string(range.piece->index) + " in block " + to_string(block->index));
+			ranges.push_back(range);
+		}
+	}
+	return ranges;
+}
+
+void RegOpt::unsplit(SplitRange& range) {
+	IrInstList instructions;
+	for (instptr_t inst : range.block->instructions) {
+		if (find(range.copies.begin(), range.copies.end(), inst) != range.copies.end()) {
+			continue;
+		}
+		renameTemp(inst, range.piece, range.temp);
+		instructions.push_back(inst);
+	}
+	range.block->instructions = instructions;
 }
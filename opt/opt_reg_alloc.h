@@ -1,10 +1,23 @@
 # pragma once
 #include "opt.h" 
+#include "opt_cfg.h"
+#include <map>
+#include <set>
 #include <vector>
 
+// a temp that didn't get a register, replaced over one block by a new one
+// that may
+struct SplitRange {
+	BasicBlock* block;
+	tempptr_t temp;
+	tempptr_t piece;
+	IrInstList copies;  // the moves between the two added to the block
+};
+
 class RegOpt : public IrOpt {
 private: 
-	vector<x64asm::R64> freeRegisters = {
+	// r10 is left out: the code generator keeps it as its scratch reg
+	vector<x64asm::R64> registers = {
 	    x64asm::rdi,
 	    x64asm::rsi,
 	    x64asm::rax,
@@ -13,18 +26,36 @@ private:
 	    x64asm::rdx,
 	    x64asm::r8,
 	    x64asm::r9,
-        // TODO: uncomment this
-	    //x64asm::r10,
 	    x64asm::r11,
 	    x64asm::r12,
 	    x64asm::r13,
 	    x64asm::r14,
 	    x64asm::r15,
 	};
+	// kept by the helpers the code generator calls, so saved once in the
+	// prolog rather than around every call
+	set<x64asm::R64> calleeSaved = {
+	    x64asm::rbx,
+	    x64asm::r12,
+	    x64asm::r13,
+	    x64asm::r14,
+	    x64asm::r15,
+	};
     IrInstList instructions;
-    void run();
-    void executeStep();
-	int linearScan(IrFunc* irFunc);
+	// how much spilling each temp would cost, counting each use and def
+	// ten times for each loop it's in
+	map<int, double> spillWeights(Cfg& cfg);
+	// positions of the instructions the code generator always turns into
+	// helper calls, which save the caller-saved regs live across them.
+	// slow paths are left out, since they're rarely taken
+	vector<int> helperCalls(IrFunc* irFunc);
+	int allocate(IrFunc* irFunc, map<int, double>& weights);
+	// works out the live ranges and weights again and reallocates
+	int reallocate(Cfg& cfg);
+	// gives spilled temps a piece of their own over each block where that
+	// saves more memory accesses than the copies in and out of it cost
+	vector<SplitRange> split(Cfg& cfg);
+	void unsplit(SplitRange& range);
 public: 
     int optimize(IrFunc* irFunc) override;
 };
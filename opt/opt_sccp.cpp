@@ -0,0 +1,460 @@
+#include "opt_sccp.h"
+#include <cassert>
+#include <climits>
+
+/************************
+ * FOLDING
+ ***********************/
+// unboxed ints wrap at 30 bits, like the vm's once make_ptr shifts them
+static tagptr_t wrap(int64_t val) {
+    return (int32_t) ((uint32_t) val << SHIFT) >> SHIFT;
+}
+
+static bool foldUnary(IrOp op, tagptr_t val, tagptr_t& result) {
+    switch (op) {
+        case IrOp::UnboxInteger:
+            if (!check_tag(val, INT_TAG)) {
+                return false;
+            }
+            result = get_int(val);
+            return true;
+        case IrOp::UnboxBoolean:
+            if (!check_tag(val, BOOL_TAG)) {
+                return false;
+            }
+            result = get_bool(val);
+            return true;
+        case IrOp::NewInteger:
+            result = make_ptr((int) val);
+            return true;
+        case IrOp::NewBoolean:
+            result = make_ptr((bool) val);
+            return true;
+        case IrOp::Neg:
+            result = wrap(-val);
+            return true;
+        case IrOp::Not:
+            result = !val;
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool foldBinary(IrOp op, tagptr_t left, tagptr_t right, tagptr_t& result) {
+    switch (op) {
+        case IrOp::Sub:
+            result = wrap(left - right);
+            return true;
+        case IrOp::Mul:
+            result = wrap(left * right);
+            return true;
+        case IrOp::Div:
+            // leave the errors and the overflow to run time
+            if (right == 0 || (left == INT_MIN && right == -1)) {
+                return false;
+            }
+            result = wrap(left / right);
+            return true;
+        case IrOp::AddInteger:
+            result = wrap(left + right);
+            return true;
+        case IrOp::Gt:
+            result = left > right;
+            return true;
+        case IrOp::Geq:
+            result = left >= right;
+            return true;
+        case IrOp::EqInteger:
+            result = left == right;
+            return true;
+        case IrOp::And:
+            result = left && right;
+            return true;
+        case IrOp::Or:
+            result = left || right;
+            return true;
+        case IrOp::Add:
+            // ints, or a string and anything printable without a heap value
+            if ((check_tag(left, INT_TAG) && check_tag(right, INT_TAG)) ||
+                    (is_tagged(left) && is_tagged(right) &&
+                     (check_tag(left, STR_TAG) || check_tag(right, STR_TAG)))) {
+                result = ptr_add(left, right);
+                return true;
+            }
+            return false;
+        case IrOp::Eq:
+            // values with different tags are never equal, so only two
+            // heap values need a look at run time
+            if (!is_tagged(left) && !is_tagged(right)) {
+                return false;
+            }
+            result = ptr_equals(left, right);
+            return true;
+        default:
+            return false;
+    }
+}
+
+/************************
+ * SOLVER
+ ***********************/
+LatticeVal SccpOpt::get(tempptr_t temp) {
+    auto it = values.find(temp->index);
+    if (it == values.end()) {
+        // locals on entry, which hold whatever the caller passed in
+        return LatticeVal{LatticeVal::BOTTOM};
+    }
+    return it->second;
+}
+
+void SccpOpt::lower(tempptr_t temp, LatticeVal val) {
+    LatticeVal& old = values[temp->index];
+    LatticeVal merged = old;
+    if (old.state == LatticeVal::TOP) {
+        merged = val;
+    } else if (val.state == LatticeVal::TOP) {
+        return;
+    } else if (old.state == LatticeVal::CONSTANT &&
+            !(val.state == LatticeVal::CONSTANT && val.value == old.value)) {
+        merged.state = LatticeVal::BOTTOM;
+    }
+    if (merged.state != old.state) {
+        old = merged;
+        tempWork.push_back(temp->index);
+    }
+}
+
+LatticeVal SccpOpt::evaluate(instptr_t inst, BasicBlock* block) {
+    TempListPtr temps = inst->tempIndices;
+    LatticeVal result;
+    switch (inst->op) {
+        case IrOp::LoadConst:
+            return LatticeVal{LatticeVal::CONSTANT, func->constants_.at(inst->op0.value())};
+        case IrOp::StoreLocal:
+            return get(temps->at(1));
+        case IrOp::Phi:
+            // meet of the operands coming in over executable edges
+            for (int i = 0; i < block->preds.size(); i++) {
+                if (executableEdges.count({block->preds.at(i), block}) == 0) {
+                    continue;
+                }
+                LatticeVal val = get(temps->at(1 + i));
+                if (val.state == LatticeVal::BOTTOM ||
+                        (result.state == LatticeVal::CONSTANT &&
+                         val.state == LatticeVal::CONSTANT && val.value != result.value)) {
+                    return LatticeVal{LatticeVal::BOTTOM};
+                }
+                if (val.state == LatticeVal::CONSTANT) {
+                    result = val;
+                }
+            }
+            return result;
+        case IrOp::UnboxInteger:
+        case IrOp::UnboxBoolean:
+        case IrOp::NewInteger:
+        case IrOp::NewBoolean:
+        case IrOp::Neg:
+        case IrOp::Not:
+            {
+                LatticeVal val = get(temps->at(1));
+                if (val.state != LatticeVal::CONSTANT) {
+                    return val;
+                }
+                result.state = foldUnary(inst->op, val.value, result.value) ?
+                    LatticeVal::CONSTANT : LatticeVal::BOTTOM;
+                return result;
+            }
+        case IrOp::Add:
+        case IrOp::Sub:
+        case IrOp::Mul:
+        case IrOp::Div:
+        case IrOp::AddInteger:
+        case IrOp::Gt:
+        case IrOp::Geq:
+        case IrOp::EqInteger:
+        case IrOp::Eq:
+        case IrOp::And:
+        case IrOp::Or:
+            {
+                LatticeVal right = get(temps->at(1));
+                LatticeVal left = get(temps->at(2));
+                if (left.state == LatticeVal::BOTTOM || right.state == LatticeVal::BOTTOM) {
+                    return LatticeVal{LatticeVal::BOTTOM};
+                }
+                if (left.state == LatticeVal::TOP || right.state == LatticeVal::TOP) {
+                    return result;
+                }
+                result.state = foldBinary(inst->op, left.value, right.value, result.value) ?
+                    LatticeVal::CONSTANT : LatticeVal::BOTTOM;
+                return result;
+            }
+        default:
+            return LatticeVal{LatticeVal::BOTTOM};
+    }
+}
+
+LatticeVal SccpOpt::branchCondition(instptr_t inst) {
+    TempListPtr temps = inst->tempIndices;
+    if (inst->op == IrOp::If) {
+        LatticeVal cond = get(temps->at(0));
+        if (cond.state == LatticeVal::CONSTANT) {
+            cond.value = cond.value != 0;
+        }
+        return cond;
+    }
+    if (inst->op == IrOp::IfClosureOf) {
+        // closures are never constants
+        return LatticeVal{LatticeVal::BOTTOM};
+    }
+    LatticeVal right = get(temps->at(0));
+    LatticeVal left = get(temps->at(1));
+    if (left.state == LatticeVal::BOTTOM || right.state == LatticeVal::BOTTOM) {
+        return LatticeVal{LatticeVal::BOTTOM};
+    }
+    if (left.state == LatticeVal::TOP || right.state == LatticeVal::TOP) {
+        return LatticeVal{};
+    }
+    if (!check_tag(left.value, INT_TAG) || !check_tag(right.value, INT_TAG)) {
+        // the assert before the branch throws
+        return LatticeVal{LatticeVal::BOTTOM};
+    }
+    int l = get_int(left.value);
+    int r = get_int(right.value);
+    bool taken = inst->op == IrOp::IfGt ? l > r :
+        inst->op == IrOp::IfGeq ? l >= r : l == r;
+    return LatticeVal{LatticeVal::CONSTANT, taken};
+}
+
+BasicBlock* SccpOpt::fallthrough(instptr_t inst, BasicBlock* block) {
+    BasicBlock* target = cfg->labelBlock(inst->op0.value());
+    for (BasicBlock* succ : block->succs) {
+        if (succ != target) {
+            return succ;
+        }
+    }
+    // the branch goes to the next block either way
+    return target;
+}
+
+void SccpOpt::markEdge(BasicBlock* from, BasicBlock* to) {
+    if (executableEdges.insert({from, to}).second) {
+        edgeWork.push_back({from, to});
+    }
+}
+
+void SccpOpt::visitBranch(instptr_t inst, BasicBlock* block) {
+    LatticeVal cond = branchCondition(inst);
+    if (cond.state == LatticeVal::TOP) {
+        return;
+    }
+    if (cond.state == LatticeVal::BOTTOM || cond.value) {
+        markEdge(block, cfg->labelBlock(inst->op0.value()));
+    }
+    if (cond.state == LatticeVal::BOTTOM || !cond.value) {
+        markEdge(block, fallthrough(inst, block));
+    }
+}
+
+void SccpOpt::visit(instptr_t inst, BasicBlock* block) {
+    switch (inst->op) {
+        case IrOp::If:
+        case IrOp::IfGt:
+        case IrOp::IfGeq:
+        case IrOp::IfEqInteger:
+        case IrOp::IfClosureOf:
+            visitBranch(inst, block);
+            return;
+        case IrOp::Goto:
+            markEdge(block, cfg->labelBlock(inst->op0.value()));
+            return;
+        default:
+            break;
+    }
+    opttemp_t def = irDef(inst);
+    if (def) {
+        lower(def.value(), evaluate(inst, block));
+    }
+}
+
+void SccpOpt::visitBlock(BasicBlock* block) {
+    for (instptr_t phi : block->phis) {
+        visit(phi, block);
+    }
+    for (instptr_t inst : block->instructions) {
+        visit(inst, block);
+    }
+    if (block->instructions.empty() || !irIsJump(block->instructions.back())) {
+        for (BasicBlock* succ : block->succs) {
+            markEdge(block, succ);
+        }
+    }
+}
+
+void SccpOpt::solve() {
+    executable.insert(cfg->blocks.front().get());
+    visitBlock(cfg->blocks.front().get());
+    while (!edgeWork.empty() || !tempWork.empty()) {
+        while (!edgeWork.empty()) {
+            auto edge = edgeWork.back();
+            edgeWork.pop_back();
+            BasicBlock* to = edge.second;
+            if (executable.insert(to).second) {
+                visitBlock(to);
+            } else {
+                // only the phis can see the new edge
+                for (instptr_t phi : to->phis) {
+                    visit(phi, to);
+                }
+            }
+        }
+        while (!tempWork.empty()) {
+            int temp = tempWork.back();
+            tempWork.pop_back();
+            for (auto use : users[temp]) {
+                if (executable.count(use.second) > 0) {
+                    visit(use.first, use.second);
+                }
+            }
+        }
+    }
+}
+
+/************************
+ * TRANSFORMATION
+ ***********************/
+int SccpOpt::foldBranches() {
+    int changes = 0;
+    for (blockptr_t block : cfg->blocks) {
+        IrInstList& insts = block->instructions;
+        if (executable.count(block.get()) == 0 || insts.empty()) {
+            continue;
+        }
+        instptr_t last = insts.back();
+        if (!irIsJump(last) || last->op == IrOp::Goto || last->op == IrOp::Return) {
+            continue;
+        }
+        LatticeVal cond = branchCondition(last);
+        if (cond.state != LatticeVal::CONSTANT) {
+            continue;
+        }
+        BasicBlock* target = cfg->labelBlock(last->op0.value());
+        BasicBlock* next = fallthrough(last, block.get());
+        if (cond.value) {
+            insts.back() = make_shared<IrInstruction>(IrOp::Goto, last->op0.value());
+            if (next != target) {
+                cfg->removeEdge(block.get(), next);
+            }
+        } else {
+            insts.pop_back();
+            if (next != target) {
+                cfg->removeEdge(block.get(), target);
+            }
+        }
+        changes++;
+    }
+    // blocks no executable edge reaches are gone along with the edges
+    cfg->update();
+    return changes;
+}
+
+int SccpOpt::rewrite() {
+    // replaces everything computing a constant with a load of it
+    int changes = 0;
+    for (blockptr_t block : cfg->blocks) {
+        IrInstList loads;
+        for (auto it = block->phis.begin(); it != block->phis.end();) {
+            tempptr_t def = (*it)->tempIndices->at(0);
+            LatticeVal val = get(def);
+            if (val.state == LatticeVal::CONSTANT) {
+                loads.push_back(make_shared<IrInstruction>(
+                            IrOp::LoadConst, func->constantIndex(val.value), def));
+                it = block->phis.erase(it);
+                changes++;
+            } else {
+                it++;
+            }
+        }
+        IrInstList& insts = block->instructions;
+        for (instptr_t& inst : insts) {
+            opttemp_t def = irDef(inst);
+            if (!def || inst->op == IrOp::LoadConst) {
+                continue;
+            }
+            LatticeVal val = get(def.value());
+            if (val.state == LatticeVal::CONSTANT) {
+                inst = make_shared<IrInstruction>(
+                        IrOp::LoadConst, func->constantIndex(val.value), def.value());
+                changes++;
+            }
+        }
+        auto afterLabels = insts.begin();
+        while (afterLabels != insts.end() && (*afterLabels)->op == IrOp::AddLabel) {
+            afterLabels++;
+        }
+        insts.insert(afterLabels, loads.begin(), loads.end());
+    }
+    return changes;
+}
+
+int SccpOpt::removeChecks() {
+    // type checks of constants either always pass or always throw
+    int changes = 0;
+    for (blockptr_t block : cfg->blocks) {
+        IrInstList& insts = block->instructions;
+        for (auto it = insts.begin(); it != insts.end();) {
+            int tag;
+            switch ((*it)->op) {
+                case IrOp::AssertInteger:
+                case IrOp::GuardInteger:
+                    tag = INT_TAG;
+                    break;
+                case IrOp::AssertBoolean:
+                    tag = BOOL_TAG;
+                    break;
+                case IrOp::AssertString:
+                    tag = STR_TAG;
+                    break;
+                default:
+                    it++;
+                    continue;
+            }
+            LatticeVal val = get((*it)->tempIndices->at(0));
+            if (val.state == LatticeVal::CONSTANT && check_tag(val.value, tag)) {
+                it = insts.erase(it);
+                changes++;
+            } else {
+                it++;
+            }
+        }
+    }
+    return changes;
+}
+
+int SccpOpt::optimize(IrFunc* irFunc) {
+    func = irFunc;
+    cfg = irFunc->cfg;
+    if (cfg->blocks.empty()) {
+        return 0;
+    }
+    assert (cfg->isSsa());
+    for (blockptr_t block : cfg->blocks) {
+        for (IrInstList* insts : {&block->phis, &block->instructions}) {
+            for (instptr_t inst : *insts) {
+                opttemp_t def = irDef(inst);
+                if (def) {
+                    values[def.value()->index] = LatticeVal{};
+                }
+                for (tempptr_t use : irUses(func, inst)) {
+                    users[use->index].push_back({inst, block.get()});
+                }
+            }
+        }
+    }
+    solve();
+    int changes = foldBranches();
+    changes += rewrite();
+    changes += removeChecks();
+    changes += cfg->removeDeadCode();
+    return changes;
+}
@@ -0,0 +1,48 @@
+# pragma once
+#include "opt.h"
+#include "opt_cfg.h"
+#include "opt_tag_ptr.h"
+#include <map>
+#include <set>
+#include <vector>
+
+// A value in the constant propagation lattice. Temps start out as TOP
+// (no value seen yet), can be lowered to a single CONSTANT, and end up at
+// BOTTOM once they may hold more than one value.
+struct LatticeVal {
+    enum State { TOP, CONSTANT, BOTTOM } state = TOP;
+    // raw bits: a tagged pointer, or an unboxed int or bool for the
+    // temps holding those
+    tagptr_t value = 0;
+};
+
+// Sparse conditional constant propagation over the ssa form
+class SccpOpt : public IrOpt {
+private:
+    Cfg* cfg;
+    map<int, LatticeVal> values;  // temp index -> lattice value
+    map<int, vector<pair<instptr_t, BasicBlock*>>> users;  // temp index -> uses
+    set<BasicBlock*> executable;
+    set<pair<BasicBlock*, BasicBlock*>> executableEdges;
+    vector<pair<BasicBlock*, BasicBlock*>> edgeWork;
+    vector<int> tempWork;
+
+    LatticeVal get(tempptr_t temp);
+    void lower(tempptr_t temp, LatticeVal val);
+    LatticeVal evaluate(instptr_t inst, BasicBlock* block);
+    void visit(instptr_t inst, BasicBlock* block);
+    void visitBranch(instptr_t inst, BasicBlock* block);
+    void visitBlock(BasicBlock* block);
+    void markEdge(BasicBlock* from, BasicBlock* to);
+    // the successor a conditional branch goes to when it isn't taken
+    BasicBlock* fallthrough(instptr_t inst, BasicBlock* block);
+    // whether a conditional branch is taken, as a constant 1 or 0
+    LatticeVal branchCondition(instptr_t inst);
+    void solve();
+
+    int rewrite();
+    int foldBranches();
+    int removeChecks();
+public:
+    int optimize(IrFunc* irFunc) override;
+};
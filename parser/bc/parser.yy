@@ -37,6 +37,7 @@ using namespace std;
 #include "../../types.h"
 
 #include <cassert>
+#include <algorithm>
 
 int32_t safe_cast(int64_t value);
 uint32_t safe_unsigned_cast(int64_t value);
@@ -95,6 +96,7 @@ int yyerror(BCLTYPE * yylloc, yyscan_t yyscanner, Function*& out, const char* me
 %token T_local_vars;
 %token T_local_ref_vars;
 %token T_free_vars;
+%token T_by_value_free_vars;
 %token T_names;
 %token T_labels;
 %token T_instructions;
@@ -144,6 +146,7 @@ int yyerror(BCLTYPE * yylloc, yyscan_t yyscanner, Function*& out, const char* me
 
 %type<identlist> IdentListStar
 %type<identlist> IdentListPlus
+%type<identlist> ByValueFreeVars
 
 %type<maplist> MapListStar
 %type<maplist> MapListPlus
@@ -168,16 +171,30 @@ Function:
   T_local_vars '=' '[' IdentListStar ']'         ','
   T_local_ref_vars '='  '[' IdentListStar ']'    ','
   T_free_vars '=' '[' IdentListStar ']'          ','
+  ByValueFreeVars
   T_names     '=' '[' IdentListStar ']'          ','
   T_labels    '=' '{' MapListStar '}'          ','
   T_instructions '=' '[' InstructionList ']'
   '}'
 {
-	$$ = new Function{*$6, *$12, safe_cast($17), *$22, *$28, *$34, *$40, *$46, *$52};
+	$$ = new Function{*$6, *$12, safe_cast($17), *$22, *$28, *$34, *$41, *$47, *$53};
+
+    for (auto& var : $$->free_vars_) {
+        bool byValue = find($37->begin(), $37->end(), var) != $37->end();
+        $$->free_by_value_.push_back(byValue);
+    }
+    delete $37;
 
     out = $$;
 }
 
+ByValueFreeVars:
+  %empty { $$ = new vector<string>(); }
+| T_by_value_free_vars '=' '[' IdentListStar ']' ','
+{
+	$$ = $4;
+}
+
 FunctionListStar:
   %empty { $$ = new vector<Function*>(); }
 | FunctionListPlus
@@ -79,6 +79,21 @@ public:
         print("local_vars", function.local_vars_, os);
         print("local_ref_vars", function.local_reference_vars_, os);
         print("free_vars", function.free_vars_, os);
+
+        // only functions capturing something by value list it
+        std::vector<std::string> by_value_free_vars;
+        for (size_t i = 0; i < function.free_by_value_.size(); ++i)
+        {
+            if (function.free_by_value_[i])
+            {
+                by_value_free_vars.push_back(function.free_vars_[i]);
+            }
+        }
+        if (!by_value_free_vars.empty())
+        {
+            print("by_value_free_vars", by_value_free_vars, os);
+        }
+
         print("names", function.names_, os);
         print("labels", function.labels_, os);
 
@@ -2,7 +2,8 @@
 ROOT=$(git rev-parse --show-toplevel)
 DIR=$ROOT/tests/gc/
 LIMIT="4"  # in MB
-PROG="${ROOT}/mitscript --opt=all -mem $LIMIT -s"
+OPT=${OPT:-"--opt=all"}  # e.g. OPT=--opt=osr to collect during on-stack replaced loops
+PROG="${ROOT}/mitscript ${OPT} -mem $LIMIT -s"
 TEST_FILE_EXT=".mit"
 THIS_FILE="test_massif.sh"
 
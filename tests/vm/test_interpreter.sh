@@ -1,7 +1,8 @@
 #!/bin/bash
 ROOT=$(git rev-parse --show-toplevel)
 DIR=$ROOT/tests/vm/
-PROG="${ROOT}/mitscript --opt=all -s"
+OPT=${OPT:-"--opt=all"}  # e.g. OPT=--opt=osr to test on-stack replacement
+PROG="${ROOT}/mitscript ${OPT} -s"
 TEST_FILE_EXT=".mit"
 TARGET_FILE_EXT=".output"
 THIS_FILE="test_interpreter.sh"
@@ -43,7 +43,8 @@ void Function::follow(CollectedHeap& heap) {
         heap.markSuccessors(f);
     }
     for (tagptr_t c : constants_) {
-        if (!is_tagged(c)) {
+        // an on-stack replaced loop's region returns NULL_PTR when it exits
+        if (c != NULL_PTR && !is_tagged(c)) {
             heap.markSuccessors(get_collectable(c));
         }
     }
@@ -60,6 +61,22 @@ size_t Function::getSize() {
     return overhead + funcsSize + consSize + localsSize + refsSize + freeSize + namesSize + instrSize;
 }
 
+void Function::recordFeedback(int index, bool sawInts) {
+    if (typeFeedback.size() != instructions.size()) {
+        typeFeedback.resize(instructions.size(), 0);
+    }
+    typeFeedback[index] |= sawInts ? FEEDBACK_INT : FEEDBACK_OTHER;
+}
+
+void Function::recordCallTarget(int index, Function* target) {
+    auto it = callTargets.find(index);
+    if (it == callTargets.end()) {
+        callTargets[index] = target;
+    } else if (it->second != target) {
+        it->second = nullptr;
+    }
+}
+
 /* None */
 const string None::typeS = "None";
 string None::toString() {
@@ -162,10 +179,10 @@ string Record::toString() {
     res += "}";
     return res;
 }
-tagptr_t Record::get(string key) {
+tagptr_t Record::get(const string& key) {
     return value[key];
 }
-void Record::set(string key, tagptr_t val, CollectedHeap& collector) {
+void Record::set(const string& key, tagptr_t val, CollectedHeap& collector) {
     if (value.count(key) == 0) {
         collector.increment(sizeof(key) + key.size() + sizeof(val));
     }
@@ -205,11 +222,13 @@ bool Closure::equals(Value* other) {
     if (func != otherV->func) {
         return false;
     }
-    if (refs.size() != otherV->refs.size()) {
+    if (numRefs != otherV->numRefs) {
         return false;
     }
-    for (int i = 0; i < refs.size(); i++) {
-        if (refs[i] != otherV->refs[i]) {
+    for (int i = 0; i < numRefs; i++) {
+        // closures capturing by value also capture a ref local to the
+        // activation they come from, so this tells those apart too
+        if (refs()[i] != otherV->refs()[i]) {
             return false;
         }
     }
@@ -217,21 +236,22 @@ bool Closure::equals(Value* other) {
 }
 size_t Closure::getSize() {
     size_t overhead = sizeof(Closure);
-    size_t refsSize = getVecSize(refs);
+    size_t refsSize = numRefs * sizeof(tagptr_t);
     return overhead + refsSize;
 }
 void Closure::follow(CollectedHeap& heap) {
     // follow the refs and the function
-    for (ValWrapper* v : refs) {
-        heap.markSuccessors(v);
+    for (int i = 0; i < numRefs; i++) {
+        if (!is_tagged(refs()[i])) {
+            heap.markSuccessors(get_collectable(refs()[i]));
+        }
     }
     heap.markSuccessors(func);
 }
 
 /* Native functions */
 tagptr_t PrintNativeFunction::evalNativeFunction(Frame& currentFrame, CollectedHeap& ch) {
-    string name = currentFrame.getLocalByIndex(0);
-    auto val = currentFrame.getLocalVar(name);
+    auto val = currentFrame.getLocal(0);
     cout << ptr_to_str(val) << endl;
     return ch.allocate<None>();
 };
@@ -241,8 +261,7 @@ tagptr_t InputNativeFunction::evalNativeFunction(Frame& currentFrame, CollectedH
     return make_ptr(input);
 };
 tagptr_t IntcastNativeFunction::evalNativeFunction(Frame& currentFrame, CollectedHeap& ch) {
-    string name = currentFrame.getLocalByIndex(0);
-    auto val = currentFrame.getLocalVar(name);
+    auto val = currentFrame.getLocal(0);
     if (check_tag(val, INT_TAG)) {
         return val;
     }
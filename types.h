@@ -23,13 +23,30 @@ using experimental::nullopt;
 
 #define LOG(msg) { if (false) cerr << msg << endl; }
 
+// type feedback bits recorded by the vm for each instruction
+#define FEEDBACK_INT 1  // every operand was an int
+#define FEEDBACK_OTHER 2  // some operand was not an int
+
 class Frame;
 class Collectable;
 class MachineCodeFunction;
 
+// what a heap value is, for the type checks compiled code does inline.
+// subclasses of these are their base's kind
+enum class ValueKind : uint8_t {
+    Other,
+    Function,
+    ValWrapper,
+    Record,
+    Closure
+};
+
 struct Value : public Collectable {
     // Abstract class for program values that can be stored on a frame's
     // operand stack
+    ValueKind kind;
+
+    Value(ValueKind kind = ValueKind::Other): kind(kind) {}
     virtual ~Value() {}
 
     // instance function that returns type of value as a string
@@ -54,6 +71,7 @@ struct Value : public Collectable {
 
 struct Constant: public Value {
     // Abstract class for constant program values
+    Constant(ValueKind kind = ValueKind::Other): Value(kind) {}
     virtual ~Constant() {};
     static const string typeS;
 };
@@ -81,18 +99,55 @@ struct Function : public Value {
     // list of the names of non-global and non-local variables accessed by the function
     vector<string> free_vars_;
 
+    // whether each free var is captured by value: closures hold the value
+    // itself instead of a ValWrapper. bytecode lists these by name in
+    // by_value_free_vars, which it leaves out when there are none
+    vector<bool> free_by_value_;
+    bool freeByValue(int index) {
+        return index < free_by_value_.size() && free_by_value_[index];
+    }
+
     // list of global variable and field names used inside the function
     vector<string> names_;
 
+    // slot in the interpreter's global table of each name LoadGlobal or
+    // StoreGlobal uses, by index in names_; -1 for the rest
+    vector<int> global_slots_;
+
+    // index in a frame's refs of each local closures capture, by index in
+    // local_vars_; -1 for the locals kept in the frame as they are
+    vector<int> local_ref_slots_;
+
+    // most operands the function's code has on the stack at once, which
+    // with its locals and refs is the room its vm frames take
+    int max_stack_ = 0;
+
     // map of label indices to instruction indices
     map<int, int> labels_;
 
     // store a pointer to the compiled version
     MachineCodeFunction* mcf = nullptr;
 
+    // the closure every AllocClosure of this function makes, if it has no
+    // free vars
+    Closure* singleton = nullptr;
+
+    // FEEDBACK_* bits seen by the vm at each instruction index; the jit
+    // speculates on these when it compiles the function
+    vector<uint8_t> typeFeedback;
+    void recordFeedback(int index, bool sawInts);
+    // function called by the Call at each instruction index, or nullptr
+    // once it has called more than one; the jit inlines these
+    map<int, Function*> callTargets;
+    void recordCallTarget(int index, Function* target);
+
     BcInstructionList instructions;
+    // the instructions as the vm runs them, ending in an End, and the index
+    // in code_ each bytecode index continues at
+    VmInstructionList code_;
+    vector<int> code_index_;
 
-    Function() {};
+    Function(): Value(ValueKind::Function) {};
     virtual ~Function() {};
 
     Function(vector<Function*> functions_,
@@ -103,6 +158,7 @@ struct Function : public Value {
             vector<string> free_vars_,
 	        vector<string> names_,
             BcInstructionList instructions):
+        Value(ValueKind::Function),
         functions_(functions_),
         constants_(constants_),
 	    parameter_count_(parameter_count_),
@@ -122,6 +178,7 @@ struct Function : public Value {
 	        vector<string> names_,
             map<int, int> labels_,
             BcInstructionList instructions):
+        Value(ValueKind::Function),
         functions_(functions_),
         constants_(constants_),
 	    parameter_count_(parameter_count_),
@@ -147,8 +204,8 @@ struct ValWrapper: public Value {
     // Class for reference variables
     tagptr_t ptr;
 
-    ValWrapper() {}
-    ValWrapper(tagptr_t ptr): ptr(ptr) {};
+    ValWrapper(): Value(ValueKind::ValWrapper) {}
+    ValWrapper(tagptr_t ptr): Value(ValueKind::ValWrapper), ptr(ptr) {};
     virtual ~ValWrapper() {}
 
     static const string typeS;
@@ -243,9 +300,10 @@ struct Record : public Constant {
     // Class for record type (note that this is mutable)
 	map<string, tagptr_t> value;
 
-    tagptr_t get(string key);
-    void set(string key, tagptr_t value, CollectedHeap& collector);
+    tagptr_t get(const string& key);
+    void set(const string& key, tagptr_t value, CollectedHeap& collector);
 
+    Record(): Constant(ValueKind::Record) {}
     virtual ~Record() {}
     string toString();
     bool equals(Value* other);
@@ -259,19 +317,34 @@ struct Record : public Constant {
 };
 
 struct Closure: public Constant {
-    // Class for closure type
-
-    // list of reference variables, in the same order as listed in the function's
-    // free_vars_ list
-    vector<ValWrapper*> refs;
+    // Class for closure type. The refs are laid out inline after the
+    // closure, so closures are only made by CollectedHeap::allocate
 
     // function that the closure is for
     Function* func;
 
-    Closure(vector<ValWrapper*> refs, Function* func):
-        refs(refs), func(func) {};
+    // number of refs
+    size_t numRefs;
+
+    Closure(Function* func, size_t numRefs):
+        Constant(ValueKind::Closure), func(func), numRefs(numRefs) {};
     virtual ~Closure() {}
 
+    // list of reference variables, in the same order as listed in the function's
+    // free_vars_ list; a ValWrapper, or the value for vars captured by value.
+    // they sit in the room operator new leaves after the closure
+    tagptr_t* refs() {
+        return reinterpret_cast<tagptr_t*>(this + 1);
+    }
+
+    // makes room for the refs after the closure
+    static void* operator new(size_t size, size_t numRefs) {
+        return ::operator new(size + numRefs * sizeof(tagptr_t));
+    }
+    static void operator delete(void* ptr) {
+        ::operator delete(ptr);
+    }
+
     static const string typeS;
     string type() {
         return "Closure";
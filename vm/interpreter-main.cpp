@@ -36,6 +36,7 @@ int main(int argc, char** argv) {
     int rvalue = 0;
     int maxmem = 10000;
 	bool shouldCallAsm = false;
+    bool shouldOsr = false;
     for (int i = 1; i < argc; ++i) {
         if (strcmp(argv[i], "-b") == 0) {
             file_type = BYTECODE;
@@ -59,6 +60,9 @@ int main(int argc, char** argv) {
         } else if (strcmp(argv[i], "--opt=all") == 0) {
 			shouldCallAsm = true;
             // TODO: add other optimizations
+        } else if (strcmp(argv[i], "--opt=osr") == 0) {
+            // run in the vm, but compile hot top-level loops
+            shouldOsr = true;
 		} else {
             infile = fopen(argv[i], "r");
             if (infile == NULL) {
@@ -103,7 +107,7 @@ int main(int argc, char** argv) {
     }
 
     try {
-        Interpreter* intp = new Interpreter(bc_output, maxmem, shouldCallAsm);
+        Interpreter* intp = new Interpreter(bc_output, maxmem, shouldCallAsm, shouldOsr);
         intp->run();
     } catch (InterpreterException& exception) {
         cout << exception.toString() << endl;
@@ -7,14 +7,15 @@
 #include "interpreter.h"
 #include <algorithm>
 #include <stack>
+#include <typeinfo>
 
 using namespace std;
 
-Interpreter::Interpreter(Function* mainFunc, int maxmem, bool callAsm) {
+Interpreter::Interpreter(Function* mainFunc, int maxmem, bool callAsm, bool useOsr) {
     // initialize the garbage collector
     // note that mainFunc is not included in the gc's allocated list because
     // we never have to deallocate it
-    collector = new CollectedHeap(maxmem, mainFunc->getSize(), &frames);
+    collector = new CollectedHeap(maxmem, mainFunc->getSize(), &frames, &globalCells);
 
     // initialize a static none
     NONE = make_ptr(new None());
@@ -32,12 +33,13 @@ Interpreter::Interpreter(Function* mainFunc, int maxmem, bool callAsm) {
         throw RuntimeException("can't initialize root frame w/ nonzero local vars");
     }
     mainFunc->local_vars_ = mainFunc->names_;
-    Frame* frame = collector->allocate<Frame>(mainFunc);
-    frame->collector = collector;
-    globalFrame = frame;
-    frames.push_back(frame);
+    callEffects = new CallEffects(mainFunc);
     finished = false;
     shouldCallAsm = callAsm;
+    shouldOsr = useOsr;
+    nativeDepth = 0;
+    nativeStackTop = nullptr;
+    stepCount = 0;
 
     // set up native functions at the beginning of functions array
 	vector<Function*> functions_;
@@ -49,357 +51,636 @@ Interpreter::Interpreter(Function* mainFunc, int maxmem, bool callAsm) {
 	vector<string> names_;
     BcInstructionList instructions;
 	vector<shared_ptr<Function>> frameFuncs;
-	frame->func->functions_[0] = collector->allocate<PrintNativeFunction>(functions_, constants_, 1, args1, local_reference_vars_, free_vars_, names_, instructions);
-	frame->func->functions_[1] = collector->allocate<InputNativeFunction>(functions_, constants_, 0, args0, local_reference_vars_, free_vars_, names_, instructions);
-	frame->func->functions_[2] = collector->allocate<IntcastNativeFunction>(functions_, constants_, 1, args1, local_reference_vars_, free_vars_, names_, instructions);
+	mainFunc->functions_[0] = collector->allocate<PrintNativeFunction>(functions_, constants_, 1, args1, local_reference_vars_, free_vars_, names_, instructions);
+	mainFunc->functions_[1] = collector->allocate<InputNativeFunction>(functions_, constants_, 0, args0, local_reference_vars_, free_vars_, names_, instructions);
+	mainFunc->functions_[2] = collector->allocate<IntcastNativeFunction>(functions_, constants_, 1, args1, local_reference_vars_, free_vars_, names_, instructions);
+
+    loadProgram(mainFunc);
+    watchedGlobals.assign(globalCells.size(), 0);
+    globalFrame = &pushFrame(mainFunc, 0);
 };
 
-void Interpreter::executeStep() {
-    // executes a single instruction and updates state of interpreter
-    Frame* frame = frames.back();
-    BcInstruction& inst = frame->getCurrInstruction();
-    LOG("executing instruction " + to_string(frame->instructionIndex) + " from frame " + to_string(frames.size()));
-    switch (inst.operation) {
-        case BcOp::LoadConst:
-            {
-                auto constant = frame->getConstantByIndex(inst.operand0.value());
-                frame->opStackPush(constant);
-                frame->instructionIndex++;
-                break;
-            }
-        case BcOp::LoadFunc:
-            {
-                auto func = frame->getFunctionByIndex(inst.operand0.value());
-                frame->opStackPush(make_ptr(func));
-                frame->instructionIndex++;
-                break;
-            }
-        case BcOp::LoadLocal:
-            {
-                string name = frame->getLocalByIndex(inst.operand0.value());
-                frame->opStackPush(frame->getLocalVar(name));
-                frame->instructionIndex++;
-                break;
-            }
-        case BcOp::StoreLocal:
-            {
-                string name = frame->getLocalByIndex(inst.operand0.value());
-                tagptr_t ptr = frame->opStackPop();
-                frame->setLocalVar(name, ptr);
-                frame->instructionIndex++;
-                break;
-            }
-        case BcOp::LoadGlobal:
-            {
-                int index = inst.operand0.value();
-                string name = frame->getNameByIndex(index);
-                frame->opStackPush(loadGlobal(name));
-                frame->instructionIndex++;
-                break;
-            }
-        case BcOp::StoreGlobal:
-            {
-                int index = inst.operand0.value();
-                string name = frame->getNameByIndex(index);
-                storeGlobal(name, frame->opStackPop());
-                frame->instructionIndex++;
+int Interpreter::globalSlot(string name) {
+    auto it = globalSlots.find(name);
+    if (it != globalSlots.end()) {
+        return it->second;
+    }
+    ValWrapper* cell = collector->allocate<ValWrapper>((tagptr_t) NULL_PTR);
+    int slot = globalCells.size();
+    globalCells.push_back(cell);
+    globalNames.push_back(name);
+    globalSlots[name] = slot;
+    return slot;
+}
+
+void Interpreter::loadProgram(Function* func) {
+    loadFunction(func);
+    for (Function* inner : func->functions_) {
+        loadProgram(inner);
+    }
+}
+
+void Interpreter::loadFunction(Function* func) {
+    func->global_slots_.assign(func->names_.size(), -1);
+    func->local_ref_slots_.assign(func->local_vars_.size(), -1);
+    for (int i = 0; i < func->local_reference_vars_.size(); i++) {
+        auto local = find(func->local_vars_.begin(), func->local_vars_.end(),
+                func->local_reference_vars_[i]);
+        func->local_ref_slots_.at(local - func->local_vars_.begin()) = i;
+    }
+    // checks the operands, so neither the stack depth nor the vm has to
+    decode(func);
+    func->max_stack_ = maxStackDepth(func);
+}
+
+void Interpreter::decode(Function* func) {
+    BcInstructionList& insts = func->instructions;
+    int numRefs = func->local_reference_vars_.size() + func->free_vars_.size();
+    auto check = [](int index, size_t size, const string& kind) {
+        if (index < 0 || index >= size) {
+            throw RuntimeException(kind + " " + to_string(index) + " out of bounds");
+        }
+    };
+    func->code_.clear();
+    func->code_index_.assign(insts.size() + 1, 0);
+    for (int i = 0; i < insts.size(); i++) {
+        func->code_index_[i] = func->code_.size();
+        BcInstruction& inst = insts[i];
+        BcOp op = inst.operation;
+        if (op == BcOp::Label || op == BcOp::StartWhile || op == BcOp::EndWhile) {
+            continue;
+        }
+        int operand = inst.operand0.value_or(0);
+        switch (op) {
+            case BcOp::LoadConst:
+                check(operand, func->constants_.size(), "constant");
                 break;
-            }
-        case BcOp::PushReference:
-            {
-                string name = frame->getRefByIndex(inst.operand0.value());
-                auto valWrapper = frame->getRefVar(name);
-                frame->opStackPush(make_ptr(valWrapper));
-                frame->instructionIndex++;
+            case BcOp::LoadFunc:
+                check(operand, func->functions_.size(), "function");
                 break;
-            }
-        case BcOp::LoadReference:
-            {
-                ValWrapper* v = cast_val<ValWrapper>(frame->opStackPop());  // will raise exception if invalid type
-                frame->opStackPush(v->ptr);
-                frame->instructionIndex++;
+            case BcOp::LoadLocal:
+            case BcOp::StoreLocal:
+                check(operand, func->local_vars_.size(), "var");
                 break;
-            }
-        case BcOp::AllocRecord:
-            {
-				frame->opStackPush(collector->allocate<Record>());
-                frame->instructionIndex++;
+            case BcOp::LoadGlobal:
+            case BcOp::StoreGlobal:
+                // the vm goes straight to the slot
+                check(operand, func->names_.size(), "name");
+                func->global_slots_[operand] = globalSlot(func->names_[operand]);
+                operand = func->global_slots_[operand];
                 break;
-            }
-        case BcOp::FieldLoad:
-            {
-                Record* record = cast_val<Record>(frame->opStackPop());
-				string field = frame->getNameByIndex(inst.operand0.value());
-                if (record->value.count(field) == 0) {
-                    tagptr_t val = NONE;
-                    record->set(field, val, *collector);
-                }
-				frame->opStackPush(record->get(field));
-                frame->instructionIndex++;
+            case BcOp::PushReference:
+                check(operand, numRefs, "ref var");
                 break;
-            }
-        case BcOp::FieldStore:
-            {
-                tagptr_t ptr = frame->opStackPop();
-                Record* record = cast_val<Record>(frame->opStackPop());
-				string field = frame->getNameByIndex(inst.operand0.value());
-                record->set(field, ptr, *collector);
-                frame->instructionIndex++;
+            case BcOp::FieldLoad:
+            case BcOp::FieldStore:
+                check(operand, func->names_.size(), "name");
                 break;
-            }
-        case BcOp::IndexLoad:
-            {
-                string index = ptr_to_str(frame->opStackPop());
-                Record* record = cast_val<Record>(frame->opStackPop());
-                if (record->value.count(index) == 0) {
-                    tagptr_t val = NONE;
-                    record->set(index, val, *collector);
+            case BcOp::Goto:
+            case BcOp::If:
+                if (func->labels_.count(operand) == 0) {
+                    throw RuntimeException("label " + to_string(operand) + " not found");
                 }
-				frame->opStackPush(record->get(index));
-                frame->instructionIndex++;
+                check(func->labels_.at(operand), insts.size() + 1, "instruction");
                 break;
-            }
-        case BcOp::IndexStore:
-            // items are popped off in this order: value to store,
-            // index
-            // record
-            {
-				auto value = frame->opStackPop();
-				string index = ptr_to_str(frame->opStackPop());
-				Record* record = cast_val<Record>(frame->opStackPop());
-                record->set(index, value, *collector);
-                frame->instructionIndex++;
-                break;
-            }
-        case BcOp::AllocClosure:
-            {
-                // read num free vars, ref vars, and function off the stack
-                int numFreeVars = inst.operand0.value();
-                vector<ValWrapper*> refList;
-                for (int i = 0; i < numFreeVars; i++) {
-                    auto top = frame->opStackPop();
-                    ValWrapper* value = cast_val<ValWrapper>(top);
-                    refList.push_back(value);
-                }
-                Function* func = cast_val<Function>(frame->opStackPop());
-                if (func == NULL) {
-                    throw RuntimeException("expected Function on the stack for AllocClosure");
-                }
-                if (numFreeVars != func->free_vars_.size()) {
-                    throw RuntimeException("expected " + to_string(func->free_vars_.size()) + " reference variables but got " + to_string(numFreeVars));
-                }
-                // push new closure onto the stack
-                auto clos = collector->allocate(refList, func);
-                frame->opStackPush(make_ptr(clos));
-                frame->instructionIndex++;
+            default:
                 break;
-            }
-        case BcOp::Call:
-            {
-                // read num arguments, argument values, and closure off the stack
-                int numArgs = inst.operand0.value();
-                vector<tagptr_t> argsList;
-                for (int i = 0; i < numArgs; i++) {
-                    auto top = frame->opStackPop();
-                    if (!is_tagged(top)) {
-                        cast_val<Constant>(top);  // will raise exception if not Constant
-                    }
-                    argsList.push_back(top);
-                }
-                reverse(argsList.begin(), argsList.end());
+        }
+        func->code_.push_back({op, operand, i, nullptr, false, false, nullptr});
+        // a taken If right before an EndWhile is a loop back-edge
+        if (op == BcOp::If && i + 1 < insts.size() &&
+                insts[i + 1].operation == BcOp::EndWhile) {
+            func->code_.back().backEdge = true;
+        }
+        // a var captured by value is held as it is, and only ever pushed to
+        // be read by the LoadReference after it, which can go
+        int freeIndex = operand - func->local_reference_vars_.size();
+        if (op == BcOp::PushReference && freeIndex >= 0 && func->freeByValue(freeIndex) &&
+                i + 1 < insts.size() && insts[i + 1].operation == BcOp::LoadReference) {
+            func->code_index_[++i] = func->code_.size();
+        }
+    }
+    func->code_index_[insts.size()] = func->code_.size();
+    func->code_.push_back({BcOp::End, 0, (int) insts.size(), nullptr, false, false, nullptr});
+    // code_ is done growing, so jumps can point into it
+    for (VmInstruction& inst : func->code_) {
+        if (inst.operation == BcOp::Goto || inst.operation == BcOp::If) {
+            inst.target = &func->code_[func->code_index_[func->labels_.at(inst.operand0)]];
+        }
+    }
+}
 
-                Closure* closure = cast_val<Closure>(frame->opStackPop());
-                frame->instructionIndex++;
-                call(argsList, make_ptr(closure));
-				frame = frames.back();
-                break;
-            }
-        case BcOp::Return:
-            {
-                // take return val from top of stack & discard current frame
-                auto returnVal = frame->opStackPeek();
-                frames.pop_back();
-                if (frames.empty()) {
-                    finished = true;
-                    return;
-                }
-                frame = frames.back();
-                // push return val to top of new parent frame
-                frame->opStackPush(returnVal);
-                break;
-            }
-        case BcOp::Add:
-            {
-                auto right = frame->opStackPop();
-                auto left = frame->opStackPop();
-                tagptr_t result = ptr_add(left, right);
-                frame->opStackPush(result);
-                frame->instructionIndex++;
-                break;
-            }
-        case BcOp::Sub:
-            {
-                auto right = frame->opStackPop();
-                auto left = frame->opStackPop();
-                tagptr_t result = make_ptr(get_int(left) - get_int(right));
-                frame->opStackPush(result);
-                frame->instructionIndex++;
-                break;
-            }
-        case BcOp::Mul:
-            {
-                auto right = frame->opStackPop();
-                auto left = frame->opStackPop();
-                tagptr_t result = make_ptr(get_int(left) * get_int(right));
-                frame->opStackPush(result);
-                frame->instructionIndex++;
-                break;
-            }
-        case BcOp::Div:
-            {
-                auto right = frame->opStackPop();
-                auto left = frame->opStackPop();
-                if (get_int(right) == 0) {
-                    throw IllegalArithmeticException("cannot divide by 0");
-                }
-                tagptr_t result = make_ptr(get_int(left) / get_int(right));
-                frame->opStackPush(result);
-                frame->instructionIndex++;
-                break;
-            }
-        case BcOp::Neg:
-            {
-                auto top = frame->opStackPop();
-                frame->opStackPush(make_ptr(-get_int(top)));
-                frame->instructionIndex++;
-                break;
-            }
-        case BcOp::Gt:
-            {
-                auto right = frame->opStackPop();
-                auto left = frame->opStackPop();
-                tagptr_t result = make_ptr(get_int(left) > get_int(right));
-                frame->opStackPush(result);
-                frame->instructionIndex++;
-                break;
-            }
-        case BcOp::Geq:
-            {
-                auto right = frame->opStackPop();
-                auto left = frame->opStackPop();
-                tagptr_t result = make_ptr(get_int(left) >= get_int(right));
-                frame->opStackPush(result);
-                frame->instructionIndex++;
-                break;
-            }
-        case BcOp::Eq:
-            {
-                auto right = frame->opStackPop();
-                auto left = frame->opStackPop();
-                frame->opStackPush(ptr_equals(left, right));
-                frame->instructionIndex++;
-                break;
-            }
-        case BcOp::And:
-            {
-                auto right = frame->opStackPop();
-                auto left = frame->opStackPop();
-                tagptr_t result = make_ptr(get_bool(left) && get_bool(right));
-                frame->opStackPush(result);
-                frame->instructionIndex++;
-                break;
-            }
-        case BcOp::Or:
-            {
-                auto right = frame->opStackPop();
-                auto left = frame->opStackPop();
-                tagptr_t result = make_ptr(get_bool(left) || get_bool(right));
-                frame->opStackPush(result);
-                frame->instructionIndex++;
-                break;
-            }
-        case BcOp::Not:
-            {
-                auto top = frame->opStackPop();
-                frame->opStackPush(make_ptr(!get_bool(top)));
-                frame->instructionIndex++;
-                break;
-            }
-        case BcOp::Goto:
-            {
-                int labelIndex = inst.operand0.value();
-                frame->instructionIndex = frame->func->labels_[labelIndex];
-                break;
-            }
-        case BcOp::If:
-            {
-                auto expr = frame->opStackPop();
-                int labelIndex = inst.operand0.value();
-                if (get_bool(expr)) {
-                    frame->instructionIndex = frame->func->labels_[labelIndex];
-                } else {
-                    frame->instructionIndex++;
-                }
+int Interpreter::maxStackDepth(Function* func) {
+    // follows the code with the number of operands on the stack, which has
+    // to be the same every way an instruction is reached for frames to
+    // have room for them
+    BcInstructionList& insts = func->instructions;
+    vector<int> depths(insts.size(), 0);
+    vector<bool> reached(insts.size(), false);
+    vector<int> work;
+    int maxDepth = 0;
+    auto reach = [&](int index, int depth) {
+        if (index >= insts.size()) {
+            return;
+        }
+        if (!reached[index]) {
+            reached[index] = true;
+            depths[index] = depth;
+            work.push_back(index);
+        } else if (depths[index] != depth) {
+            throw RuntimeException("instruction " + to_string(index) + " reached with " +
+                to_string(depths[index]) + " and " + to_string(depth) + " operands on the stack");
+        }
+    };
+    reach(0, 0);
+    while (!work.empty()) {
+        int i = work.back();
+        work.pop_back();
+        BcInstruction& inst = insts[i];
+        int depth = depths[i];
+        switch (inst.operation) {
+            case BcOp::LoadConst:
+            case BcOp::LoadFunc:
+            case BcOp::LoadLocal:
+            case BcOp::LoadGlobal:
+            case BcOp::PushReference:
+            case BcOp::AllocRecord:
+            case BcOp::Dup:
+                depth++;
                 break;
-            }
-        case BcOp::StartWhile:
-            {
-                frame->instructionIndex++;
+            case BcOp::StoreLocal:
+            case BcOp::StoreGlobal:
+            case BcOp::IndexLoad:
+            case BcOp::Add:
+            case BcOp::Sub:
+            case BcOp::Mul:
+            case BcOp::Div:
+            case BcOp::Gt:
+            case BcOp::Geq:
+            case BcOp::Eq:
+            case BcOp::And:
+            case BcOp::Or:
+            case BcOp::If:
+            case BcOp::Pop:
+                depth--;
                 break;
-            }
-        case BcOp::EndWhile:
-            {
-                frame->instructionIndex++;
+            case BcOp::FieldStore:
+                depth -= 2;
                 break;
-            }
-        case BcOp::Label:
-            {
-                frame->instructionIndex++;
+            case BcOp::IndexStore:
+                depth -= 3;
                 break;
-            }
-        case BcOp::Dup:
-            {
-                auto top = frame->opStackPeek();
-                frame->opStackPush(top);
-                frame->instructionIndex++;
+            case BcOp::AllocClosure:
+            case BcOp::Call:
+                depth -= inst.operand0.value();
                 break;
-            }
-        case BcOp::Swap:
-            {
-                auto top = frame->opStackPop();
-                auto next = frame->opStackPop();
-                frame->opStackPush(top);
-                frame->opStackPush(next);
-                frame->instructionIndex++;
+            default:
                 break;
+        }
+        maxDepth = max(maxDepth, depth);
+        if (inst.operation == BcOp::Return) {
+            continue;
+        }
+        if (inst.operation == BcOp::Goto || inst.operation == BcOp::If) {
+            reach(func->labels_[inst.operand0.value()], depth);
+        }
+        if (inst.operation != BcOp::Goto) {
+            reach(i + 1, depth);
+        }
+    }
+    return maxDepth;
+}
+
+size_t Interpreter::stackTop() {
+    return frames.empty() ? 0 : frames.back().sp;
+}
+
+void Interpreter::reserveStack(size_t size) {
+    if (size > valueStack.size()) {
+        size_t grown = max(size, 2 * valueStack.size());
+        collector->increment((grown - valueStack.size()) * sizeof(tagptr_t));
+        valueStack.resize(grown);
+    }
+}
+
+Frame& Interpreter::pushFrame(Function* func, size_t base) {
+    reserveStack(base + func->local_vars_.size() + func->local_reference_vars_.size() +
+        func->free_vars_.size() + func->max_stack_);
+    frames.emplace_back(func, &valueStack, base);
+    return frames.back();
+}
+
+void Interpreter::execute(size_t depth) {
+    // runs the top frame, and whatever it calls, until the frame stack is
+    // back down to depth frames. each handler jumps straight to the next
+    // instruction's handler instead of going back around a loop
+    static void* dispatch[(int) BcOp::CallKnown + 1];
+    if (dispatch[0] == nullptr) {
+        fill(begin(dispatch), end(dispatch), &&invalid);
+#define HANDLER(op) dispatch[(int) BcOp::op] = &&op_##op
+        HANDLER(LoadConst);
+        HANDLER(LoadFunc);
+        HANDLER(LoadLocal);
+        HANDLER(StoreLocal);
+        HANDLER(LoadGlobal);
+        HANDLER(StoreGlobal);
+        HANDLER(PushReference);
+        HANDLER(LoadReference);
+        HANDLER(AllocRecord);
+        HANDLER(FieldLoad);
+        HANDLER(FieldStore);
+        HANDLER(IndexLoad);
+        HANDLER(IndexStore);
+        HANDLER(AllocClosure);
+        HANDLER(Call);
+        HANDLER(Return);
+        HANDLER(Add);
+        HANDLER(Sub);
+        HANDLER(Mul);
+        HANDLER(Div);
+        HANDLER(Neg);
+        HANDLER(Gt);
+        HANDLER(Geq);
+        HANDLER(Eq);
+        HANDLER(And);
+        HANDLER(Or);
+        HANDLER(Not);
+        HANDLER(Goto);
+        HANDLER(If);
+        HANDLER(Dup);
+        HANDLER(Swap);
+        HANDLER(Pop);
+        HANDLER(End);
+        HANDLER(AddInt);
+        HANDLER(AddStr);
+        HANDLER(EqInt);
+        HANDLER(CallKnown);
+#undef HANDLER
+    }
+#define DISPATCH() do { stepCount++; goto *dispatch[(int) pc->operation]; } while (0)
+#define NEXT() do { pc++; DISPATCH(); } while (0)
+    // only after instructions that allocate
+#define COLLECT() collect()
+    Frame* frame = &frames.back();
+    VmInstruction* pc = frame->pc;
+    tagptr_t returnVal;
+    DISPATCH();
+
+op_LoadConst:
+    frame->opStackPush(frame->func->constants_[pc->operand0]);
+    NEXT();
+op_LoadFunc:
+    frame->opStackPush(make_ptr(frame->func->functions_[pc->operand0]));
+    NEXT();
+op_LoadLocal:
+    frame->opStackPush(frame->getLocal(pc->operand0));
+    NEXT();
+op_StoreLocal:
+    frame->setLocal(pc->operand0, frame->opStackPop());
+    NEXT();
+op_LoadGlobal:
+    frame->opStackPush(loadGlobal(pc->operand0));
+    NEXT();
+op_StoreGlobal:
+    storeGlobal(pc->operand0, frame->opStackPop());
+    NEXT();
+op_PushReference:
+    // vars captured by value are pushed as they are, with no LoadReference
+    // after them
+    frame->opStackPush(frame->ref(pc->operand0));
+    NEXT();
+op_LoadReference:
+    {
+        ValWrapper* v = cast_val<ValWrapper>(frame->opStackPop());  // will raise exception if invalid type
+        frame->opStackPush(v->ptr);
+        NEXT();
+    }
+op_AllocRecord:
+    frame->opStackPush(collector->allocate<Record>());
+    COLLECT();
+    NEXT();
+op_FieldLoad:
+    {
+        Record* record = cast_val<Record>(frame->opStackPop());
+        string& field = frame->func->names_[pc->operand0];
+        auto it = record->value.find(field);
+        if (it != record->value.end()) {
+            frame->opStackPush(it->second);
+            NEXT();
+        }
+        record->set(field, NONE, *collector);
+        frame->opStackPush(NONE);
+        COLLECT();
+        NEXT();
+    }
+op_FieldStore:
+    {
+        tagptr_t ptr = frame->opStackPop();
+        Record* record = cast_val<Record>(frame->opStackPop());
+        record->set(frame->func->names_[pc->operand0], ptr, *collector);
+        COLLECT();
+        NEXT();
+    }
+op_IndexLoad:
+    {
+        string index = ptr_to_str(frame->opStackPop());
+        Record* record = cast_val<Record>(frame->opStackPop());
+        if (record->value.count(index) == 0) {
+            record->set(index, NONE, *collector);
+        }
+        frame->opStackPush(record->get(index));
+        COLLECT();
+        NEXT();
+    }
+op_IndexStore:
+    // items are popped off in this order: value to store,
+    // index
+    // record
+    {
+        tagptr_t value = frame->opStackPop();
+        string index = ptr_to_str(frame->opStackPop());
+        Record* record = cast_val<Record>(frame->opStackPop());
+        record->set(index, value, *collector);
+        COLLECT();
+        NEXT();
+    }
+op_AllocClosure:
+    {
+        // read num free vars, ref vars, and function off the stack
+        // the function is under the refs; read it first so the
+        // refs can go straight into the closure
+        int numFreeVars = pc->operand0;
+        Function* func = cast_val<Function>(frame->opStackPeek(numFreeVars));
+        if (func == NULL) {
+            throw RuntimeException("expected Function on the stack for AllocClosure");
+        }
+        if (numFreeVars != func->free_vars_.size()) {
+            throw RuntimeException("expected " + to_string(func->free_vars_.size()) + " reference variables but got " + to_string(numFreeVars));
+        }
+        Closure* clos = collector->allocate(func, numFreeVars);
+        for (int i = 0; i < numFreeVars; i++) {
+            tagptr_t ref = frame->opStackPop();
+            // vars captured by value are pushed as they are
+            if (!func->freeByValue(i)) {
+                cast_val<ValWrapper>(ref);
             }
-        case BcOp::Pop:
-            {
-                frame->opStackPop();
-                frame->instructionIndex++;
-                break;
+            clos->refs()[i] = ref;
+        }
+        frame->opStackPop();
+        // push new closure onto the stack
+        frame->opStackPush(make_ptr(clos));
+        COLLECT();
+        NEXT();
+    }
+op_Call:
+    {
+        // the closure is under the arguments, which stay where they
+        // are to become the callee's first locals
+        int numArgs = pc->operand0;
+        Closure* closure = cast_val<Closure>(frame->opStackPeek(numArgs));
+        for (int i = 0; i < numArgs; i++) {
+            tagptr_t arg = frame->opStackPeek(i);
+            if (!is_tagged(arg)) {
+                cast_val<Constant>(arg);  // will raise exception if not Constant
             }
-        default:
-            throw RuntimeException("should never get here - invalid instruction");
-    }
-	collector->gc();
-    LOG("  inst index = " << frame->instructionIndex <<
-            " || num insts = " << frame->numInstructions() <<
-            " || opstack len = " << frame->opStack.size() <<
-            " || frame num = " << frames.size());
-    if (frames.size() == 1 && frame->instructionIndex == frame->numInstructions()) {
-        // last instruction of the whole program
+        }
+        frame->func->recordCallTarget(pc->bcIndex, closure->func);
+        if (!pc->generic) {
+            // calls mostly go to the same function every time
+            bool known = numArgs == closure->func->parameter_count_ &&
+                dynamic_cast<NativeFunction*>(closure->func) == NULL;
+            pc->operation = known ? BcOp::CallKnown : BcOp::Call;
+            pc->generic = !known;
+            pc->callee = closure->func;
+        }
+        frame->pc = pc + 1;
+        callVM(frame, closure, numArgs);
+        frame = &frames.back();
+        pc = frame->pc;
+        COLLECT();
+        DISPATCH();
+    }
+op_End:
+    returnVal = NONE;
+    goto ret;
+op_Return:
+    returnVal = frame->opStackPeek();
+ret:
+    // discard the current frame and push the return val onto its caller's
+    // operand stack
+    frames.pop_back();
+    if (frames.empty()) {
         finished = true;
         return;
     }
-    if (frame->instructionIndex == frame->numInstructions()) {
-        // last instruction of current function
-        frames.pop_back();
-        frame = frames.back();
-        // push return val to top of new parent frame
-        frame->opStackPush(NONE);
+    frame = &frames.back();
+    frame->opStackPush(returnVal);
+    if (frames.size() == depth) {
+        return;
+    }
+    pc = frame->pc;
+    COLLECT();
+    DISPATCH();
+op_Add:
+    {
+        tagptr_t right = frame->opStackPop();
+        tagptr_t left = frame->opStackPop();
+        bool ints = check_tag(left, INT_TAG) && check_tag(right, INT_TAG);
+        frame->func->recordFeedback(pc->bcIndex, ints);
+        frame->opStackPush(ptr_add(left, right));
+        if (!pc->generic) {
+            bool strs = check_tag(left, STR_TAG) || check_tag(right, STR_TAG);
+            pc->operation = ints ? BcOp::AddInt : strs ? BcOp::AddStr : BcOp::Add;
+            pc->generic = !ints && !strs;
+        }
+        COLLECT();
+        NEXT();
+    }
+op_Sub:
+    {
+        tagptr_t right = frame->opStackPop();
+        tagptr_t left = frame->opStackPop();
+        frame->opStackPush(make_ptr(get_int(left) - get_int(right)));
+        NEXT();
+    }
+op_Mul:
+    {
+        tagptr_t right = frame->opStackPop();
+        tagptr_t left = frame->opStackPop();
+        frame->opStackPush(make_ptr(get_int(left) * get_int(right)));
+        NEXT();
+    }
+op_Div:
+    {
+        tagptr_t right = frame->opStackPop();
+        tagptr_t left = frame->opStackPop();
+        if (get_int(right) == 0) {
+            throw IllegalArithmeticException("cannot divide by 0");
+        }
+        frame->opStackPush(make_ptr(get_int(left) / get_int(right)));
+        NEXT();
+    }
+op_Neg:
+    frame->opStackPush(make_ptr(-get_int(frame->opStackPop())));
+    NEXT();
+op_Gt:
+    {
+        tagptr_t right = frame->opStackPop();
+        tagptr_t left = frame->opStackPop();
+        frame->opStackPush(make_ptr(get_int(left) > get_int(right)));
+        NEXT();
+    }
+op_Geq:
+    {
+        tagptr_t right = frame->opStackPop();
+        tagptr_t left = frame->opStackPop();
+        frame->opStackPush(make_ptr(get_int(left) >= get_int(right)));
+        NEXT();
+    }
+op_Eq:
+    {
+        tagptr_t right = frame->opStackPop();
+        tagptr_t left = frame->opStackPop();
+        bool ints = check_tag(left, INT_TAG) && check_tag(right, INT_TAG);
+        frame->func->recordFeedback(pc->bcIndex, ints);
+        frame->opStackPush(ptr_equals(left, right));
+        if (!pc->generic) {
+            pc->operation = ints ? BcOp::EqInt : BcOp::Eq;
+            pc->generic = !ints;
+        }
+        NEXT();
+    }
+op_And:
+    {
+        tagptr_t right = frame->opStackPop();
+        tagptr_t left = frame->opStackPop();
+        frame->opStackPush(make_ptr(get_bool(left) && get_bool(right)));
+        NEXT();
+    }
+op_Or:
+    {
+        tagptr_t right = frame->opStackPop();
+        tagptr_t left = frame->opStackPop();
+        frame->opStackPush(make_ptr(get_bool(left) || get_bool(right)));
+        NEXT();
+    }
+op_Not:
+    frame->opStackPush(make_ptr(!get_bool(frame->opStackPop())));
+    NEXT();
+op_Goto:
+    pc = pc->target;
+    DISPATCH();
+op_If:
+    {
+        if (!get_bool(frame->opStackPop())) {
+            NEXT();
+        }
+        VmInstruction* branch = pc;
+        pc = pc->target;
+        if (branch->backEdge && shouldOsr && frame == globalFrame) {
+            frame->pc = pc;
+            if (tryOsr(frame, branch->bcIndex)) {
+                if (finished) {
+                    return;
+                }
+                pc = frame->pc;
+                COLLECT();
+            }
+        }
+        DISPATCH();
+    }
+op_Dup:
+    frame->opStackPush(frame->opStackPeek());
+    NEXT();
+op_Swap:
+    {
+        tagptr_t top = frame->opStackPop();
+        tagptr_t next = frame->opStackPop();
+        frame->opStackPush(top);
+        frame->opStackPush(next);
+        NEXT();
+    }
+op_Pop:
+    frame->opStackPop();
+    NEXT();
+    // the rewritten instructions. the feedback the generic ones record is
+    // already there for the operands these take, so they don't record it
+op_AddInt:
+    {
+        tagptr_t right = frame->opStackPeek(0);
+        tagptr_t left = frame->opStackPeek(1);
+        if (!check_tag(left, INT_TAG) || !check_tag(right, INT_TAG)) {
+            pc->operation = BcOp::Add;
+            pc->generic = true;
+            goto op_Add;
+        }
+        frame->sp -= 2;
+        frame->opStackPush(make_ptr(get_int(left) + get_int(right)));
+        NEXT();
+    }
+op_AddStr:
+    {
+        tagptr_t right = frame->opStackPeek(0);
+        tagptr_t left = frame->opStackPeek(1);
+        if (!check_tag(left, STR_TAG) && !check_tag(right, STR_TAG)) {
+            pc->operation = BcOp::Add;
+            pc->generic = true;
+            goto op_Add;
+        }
+        frame->sp -= 2;
+        frame->opStackPush(make_ptr(new string(ptr_to_str(left) + ptr_to_str(right))));
+        COLLECT();
+        NEXT();
+    }
+op_EqInt:
+    {
+        tagptr_t right = frame->opStackPeek(0);
+        tagptr_t left = frame->opStackPeek(1);
+        if (!check_tag(left, INT_TAG) || !check_tag(right, INT_TAG)) {
+            pc->operation = BcOp::Eq;
+            pc->generic = true;
+            goto op_Eq;
+        }
+        frame->sp -= 2;
+        frame->opStackPush(make_ptr(left == right));
+        NEXT();
+    }
+op_CallKnown:
+    {
+        // the arity and the call target were checked for this function
+        // when the call was rewritten; only that it's still the one called
+        // is left to check
+        int numArgs = pc->operand0;
+        tagptr_t callee = frame->opStackPeek(numArgs);
+        Closure* closure = nullptr;
+        if (!is_tagged(callee) && typeid(*get_val(callee)) == typeid(Closure)) {
+            closure = static_cast<Closure*>(get_val(callee));
+        }
+        if (closure == nullptr || closure->func != pc->callee) {
+            pc->operation = BcOp::Call;
+            pc->generic = true;
+            goto op_Call;
+        }
+        for (int i = 0; i < numArgs; i++) {
+            tagptr_t arg = frame->opStackPeek(i);
+            if (!is_tagged(arg)) {
+                cast_val<Constant>(arg);  // will raise exception if not Constant
+            }
+        }
+        frame->pc = pc + 1;
+        size_t base = frame->sp - numArgs;
+        frame->sp = base - 1;
+        makeFrame(closure, base, numArgs);
+        frame = &frames.back();
+        pc = frame->pc;
+        COLLECT();
+        DISPATCH();
     }
-    frame->checkLegalInstruction();
+invalid:
+    throw RuntimeException("should never get here - invalid instruction");
+#undef DISPATCH
+#undef NEXT
+#undef COLLECT
 };
 
 void Interpreter::run() {
@@ -418,116 +699,373 @@ void Interpreter::run() {
     // runs program until termination (early return, end of statements)
     if (shouldCallAsm) {
         // create a closure objec to wrap the main function
-        vector<ValWrapper*> emptyRefs;
-        vector<tagptr_t> emptyArgs;
         Function* mainFunc = globalFrame->func;
-        // TODO: this is not on the stack anywhere. it could get spontaneously
-        // garbage-collected. How do we handle this?
-        Closure* mainClosure = collector->allocate(emptyRefs, mainFunc);
-        callAsm(emptyArgs, make_ptr(mainClosure));
+        // with no refs, this is the function's singleton closure, which is
+        // never collected
+        Closure* mainClosure = collector->allocate(mainFunc, 0);
+        callAsm(NULL, make_ptr(mainClosure));
     } else {
         // the global frame has already been created; you're ready to go
-        while (!finished) {
-            executeStep();
-        }
+        execute(0);
     }
 };
 
-tagptr_t Interpreter::call(vector<tagptr_t> argsList, tagptr_t clos_ptr) {
-    // this function takes care of figuring out whether to dispatch to
-    // the vm or assembly
+tagptr_t Interpreter::call(int numArgs, tagptr_t* args, tagptr_t clos_ptr) {
+    // calls made from compiled code end up here. compiled code can't hand
+    // control back to the vm in the middle of a call, so the callee has to
+    // run natively too
     Closure* clos = cast_val<Closure>(clos_ptr);
-    if (argsList.size() != clos->func->parameter_count_) {
-        throw RuntimeException("expected " + to_string(clos->func->parameter_count_) + " arguments, got " + to_string(argsList.size()));
-    }
-    if (shouldCallAsm) {
-        // should still check for native functions
-        NativeFunction* nativeFunc = dynamic_cast<NativeFunction*>(clos->func);
-        if (nativeFunc != NULL) {
-            return callVM(argsList, clos_ptr);
-        } else {
-            return callAsm(argsList, clos_ptr);
-        }
+    checkArgCount(numArgs, clos);
+    NativeFunction* nativeFunc = dynamic_cast<NativeFunction*>(clos->func);
+    if (nativeFunc != NULL) {
+        return callNative(numArgs, args, clos_ptr);
     } else {
-        return callVM(argsList, clos_ptr);
+        return callAsm(args, clos_ptr);
     }
 }
 
-// Different call methods for vm execution and compilation to asm
-tagptr_t Interpreter::callVM(vector<tagptr_t> argsList, tagptr_t clos_ptr) {
-    // process local refs and local vars
-    Closure* clos = cast_val<Closure>(clos_ptr);
-    int numLocals = clos->func->local_vars_.size();
-    int numRefs = clos->func->free_vars_.size();
-    Frame* newFrame = collector->allocate<Frame>(clos->func);
-    newFrame->collector = collector;
-    for (int i = 0; i < numLocals; i++) {
-        if (i < argsList.size()) {
-            string name = clos->func->local_vars_[i];
-            newFrame->setLocalVar(name, argsList[i]);
-        } else {
-            string name = clos->func->local_vars_[i];
-            newFrame->setLocalVar(name, NONE);
+void Interpreter::checkArgCount(int numArgs, Closure* clos) {
+    if (numArgs != clos->func->parameter_count_) {
+        throw RuntimeException("expected " + to_string(clos->func->parameter_count_) + " arguments, got " + to_string(numArgs));
+    }
+}
+
+Frame& Interpreter::makeFrame(Closure* clos, size_t base, int numArgs) {
+    // only the locals closures capture are boxed; the free vars come as the
+    // closure holds them
+    Function* func = clos->func;
+    int numLocalRefs = func->local_reference_vars_.size();
+    Frame& newFrame = pushFrame(func, base);
+    for (int i = numArgs; i < func->local_vars_.size(); i++) {
+        valueStack[base + i] = NONE;
+    }
+    for (int i = 0; i < numLocalRefs; i++) {
+        newFrame.ref(i) = make_ptr(collector->allocate<ValWrapper>(NONE));
+    }
+    for (int i = 0; i < func->free_vars_.size(); i++) {
+        newFrame.ref(numLocalRefs + i) = clos->refs()[i];
+    }
+    // captured arguments go into their boxes
+    for (int i = 0; i < numArgs && numLocalRefs > 0; i++) {
+        if (func->local_ref_slots_[i] >= 0) {
+            newFrame.setLocal(i, valueStack[base + i]);
         }
     }
-    for (int i = 0; i < numRefs; i++) {
-        string name = clos->func->free_vars_[i];
-        newFrame->setRefVar(name, make_ptr(clos->refs[i]));
+    return newFrame;
+}
+
+Frame& Interpreter::makeFrame(int numArgs, tagptr_t* args, Closure* clos) {
+    size_t base = stackTop();
+    reserveStack(base + numArgs);
+    copy(args, args + numArgs, valueStack.begin() + base);
+    return makeFrame(clos, base, numArgs);
+}
+
+// Different call methods for vm execution and compilation to asm
+void Interpreter::callVM(Frame* caller, Closure* clos, int numArgs) {
+    // the args and the closure under them are popped off the caller's
+    // operand stack, and the args become the callee's first locals
+    size_t base = caller->sp - numArgs;
+    caller->sp = base - 1;
+    if (numArgs != clos->func->parameter_count_) {
+        throw RuntimeException("expected " + to_string(clos->func->parameter_count_) + " arguments, got " + to_string(numArgs));
     }
     NativeFunction* nativeFunc = dynamic_cast<NativeFunction*>(clos->func);
     if (nativeFunc != NULL) {
-        tagptr_t val = nativeFunc->evalNativeFunction(*newFrame, *collector);
-        frames.back()->opStackPush(val);
-		return val;
-    } else if (newFrame->numInstructions() != 0) {
-        frames.push_back(newFrame);
-        // TODO: do we need to return something here?
-    } else {
-        tagptr_t returnVal = NONE;
-        frames.back()->opStackPush(returnVal);
-		return returnVal;
+        Frame& newFrame = makeFrame(clos, base, numArgs);
+        tagptr_t val = nativeFunc->evalNativeFunction(newFrame, *collector);
+        frames.pop_back();
+        caller->opStackPush(val);
+        return;
     }
+    // the return value gets pushed onto the caller's stack once the new
+    // frame finishes executing
+    makeFrame(clos, base, numArgs);
 }
 
-tagptr_t Interpreter::callAsm(vector<tagptr_t> argsList, tagptr_t clos_ptr) {
+tagptr_t Interpreter::callNative(int numArgs, tagptr_t* args, tagptr_t clos_ptr) {
+    Closure* clos = cast_val<Closure>(clos_ptr);
+    NativeFunction* nativeFunc = dynamic_cast<NativeFunction*>(clos->func);
+    Frame& newFrame = makeFrame(numArgs, args, clos);
+    tagptr_t val = nativeFunc->evalNativeFunction(newFrame, *collector);
+    frames.pop_back();
+    return val;
+}
+
+MachineCodeFunction* Interpreter::compile(Function* func) {
     Interpreter* self = this;
+    // convert the bc function to the ir
+    IrCompiler irc = IrCompiler(func, self);
+    IrFunc irf = irc.toIr();
+    // globals read as constants tell the inliner which closure is called,
+    // and inlined bodies read globals too
+    GlobalConstOpt globalConsts = GlobalConstOpt(self, func, callEffects);
+    globalConsts.optimize(&irf);
+    InlineOpt inliner = InlineOpt(self, func);
+    if (inliner.optimize(&irf) > 0) {
+        globalConsts.optimize(&irf);
+    }
+    // optimizations on ssa form go between these
+    Cfg cfg = Cfg(&irf);
+    cfg.toSsa();
+    irf.cfg = &cfg;
+    SccpOpt sccp = SccpOpt();
+    sccp.optimize(&irf);
+    BoxOpt box = BoxOpt();
+    box.optimize(&irf);
+    // once loop-carried ints are unboxed, the arithmetic on them can read
+    // the raw values
+    InductionOpt induction = InductionOpt();
+    if (induction.optimize(&irf) > 0) {
+        BoxOpt rebox = BoxOpt();
+        rebox.optimize(&irf);
+    }
+    EscapeOpt escape = EscapeOpt();
+    escape.optimize(&irf);
+    GvnOpt gvn = GvnOpt(callEffects);
+    gvn.optimize(&irf);
+    LicmOpt licm = LicmOpt(callEffects, self);
+    licm.optimize(&irf);
+    irf.cfg = nullptr;
+    cfg.fromSsa();
+    //TODO make optimization toggleable?
+    RegOpt reg = RegOpt();
+    irf.temp_count = reg.optimize(&irf);
+    // convert the ir to assembly
+    IrInterpreter iri = IrInterpreter(&irf, self);
+    x64asm::Function asmFunc = iri.run();
+    // create a MachineCodeFunction object
+    MachineCodeFunction* mcf = new MachineCodeFunction(2, asmFunc);
+    mcf->compile();
+    codeDeoptPoints[mcf] = irf.deoptPoints;
+    LOG("done compiling mcf");
+    return mcf;
+}
+
+tagptr_t Interpreter::callAsm(tagptr_t* args, tagptr_t clos_ptr) {
     Closure* clos = cast_val<Closure>(clos_ptr);
     if (!(clos->func->mcf)) {
-        // convert the bc function to the ir
-        IrCompiler irc = IrCompiler(clos->func, self);
-        IrFunc irf = irc.toIr();
-        //TODO make optimization toggleable?
-        RegOpt reg = RegOpt();
-		irf.temp_count = reg.optimize(&irf);
-        // convert the ir to assembly
-        IrInterpreter iri = IrInterpreter(&irf, self, irc.isLocalRef);
-        x64asm::Function asmFunc = iri.run();
-        // create a MachineCodeFunction object
-        clos->func->mcf = new MachineCodeFunction(2, asmFunc);
-        clos->func->mcf->compile();
-        LOG("done compiling mcf");
+        clos->func->mcf = compile(clos->func);
     } // else, already compiled and should be there! 
-    // put the args in an array
-    tagptr_t* argsArray = new tagptr_t[argsList.size()];
-    for (int i = 0; i < argsList.size(); i++) {
-        argsArray[i] = argsList[i];
-    }
-    // put the refs in an array 
-    vector<ValWrapper*> refs = clos->refs;
-    tagptr_t* refsArray = new tagptr_t[refs.size()];
-    for (int i = 0; i < refs.size(); i++) {
-        refsArray[i] = make_ptr(refs[i]);
-    }
-    vector<tagptr_t*> mcfArgs = {argsArray, refsArray};
+    // the args are already an array, on the caller's stack, and the refs
+    // are one inside the closure
+    tagptr_t* mcfArgs[] = {args, clos->refs()};
+    if (nativeDepth++ == 0) {
+        nativeStackTop = __builtin_frame_address(0);
+    }
     tagptr_t result = clos->func->mcf->call(mcfArgs);
+    nativeDepth--;
+    freeRetiredCode();
     LOG("done calling mcf");
     return result;
 }
 
-void Interpreter::storeGlobal(string name, tagptr_t val) {
-    globalFrame->setLocalVar(name, val);
+// On-stack replacement
+//
+// Only loops in the main function are replaced. The main function keeps all
+// of its variables in the global cells, which compiled code reads and writes
+// directly, and a while loop is a statement, so the operand
+// stack is empty at its back-edge. That means no frame state has to be copied
+// into the native frame: the compiled region is simply entered at the top of
+// the loop body and handed back to the vm when the loop exits.
+//
+// The region collects garbage as any compiled code does, with its frame
+// scanned for roots along with the rest of the stack.
+bool Interpreter::tryOsr(Frame* frame, int backEdgeIndex) {
+    // returns true if the rest of the loop was executed natively
+    if (osrEntries.count(backEdgeIndex) == 0) {
+        if (loopStartSteps.count(backEdgeIndex) == 0) {
+            loopStartSteps[backEdgeIndex] = stepCount;
+        }
+        if (stepCount - loopStartSteps[backEdgeIndex] < OSR_THRESHOLD) {
+            return false;
+        }
+        int exitIndex;
+        Function* osrFunc = buildOsrFunction(frame->func, backEdgeIndex, exitIndex);
+        // remember loops we can't compile so we don't try again
+        if (osrFunc) {
+            osrFunc->mcf = compile(osrFunc);
+        }
+        osrEntries[backEdgeIndex] = {unique_ptr<Function>(osrFunc), exitIndex};
+        LOG("compiled osr region ending at " + to_string(exitIndex));
+    }
+    OsrEntry& entry = osrEntries[backEdgeIndex];
+    if (entry.func == nullptr) {
+        return false;
+    }
+    if (entry.func->mcf == NULL) {
+        // thrown away since, by a deopt or a changed global
+        entry.func->mcf = compile(entry.func.get());
+    }
+    tagptr_t* mcfArgs[] = {NULL, NULL};  // no args or refs
+    if (nativeDepth++ == 0) {
+        nativeStackTop = __builtin_frame_address(0);
+    }
+    tagptr_t result = entry.func->mcf->call(mcfArgs);
+    nativeDepth--;
+    freeRetiredCode();
+    if (result == NULL_PTR) {
+        // fell out of the loop; continue after it in the vm
+        Function* func = frame->func;
+        frame->pc = &func->code_[func->code_index_[entry.exitIndex + 1]];
+    } else {
+        // the loop executed a return statement, which ends the program
+        finished = true;
+    }
+    return true;
+}
+
+Function* Interpreter::buildOsrFunction(Function* func, int backEdgeIndex, int& exitIndex) {
+    // creates a function containing the outermost loop around backEdgeIndex
+    // that starts executing at the body of the loop ending in backEdgeIndex
+    BcInstructionList& insts = func->instructions;
+    int depth = 0;
+    int startIndex = -1;
+    exitIndex = -1;
+    for (int i = 0; i < insts.size(); i++) {
+        if (insts[i].operation == BcOp::StartWhile) {
+            if (depth == 0) {
+                startIndex = i;
+            }
+            depth++;
+        } else if (insts[i].operation == BcOp::EndWhile) {
+            depth--;
+            if (depth == 0 && i > backEdgeIndex) {
+                exitIndex = i;
+                break;
+            }
+        }
+    }
+    if (startIndex < 0 || exitIndex < 0 || startIndex > backEdgeIndex) {
+        return NULL;
+    }
+    BcInstructionList osrInsts;
+    osrInsts.push_back(BcInstruction(BcOp::Goto, insts[backEdgeIndex].operand0));
+    osrInsts.insert(osrInsts.end(), insts.begin() + startIndex, insts.begin() + exitIndex + 1);
+    // falling out of the loop returns NULL_PTR, which no MITScript value
+    // can be, to tell it apart from an actual return
+    vector<tagptr_t> constants = func->constants_;
+    constants.push_back(NULL_PTR);
+    osrInsts.push_back(BcInstruction(BcOp::LoadConst, constants.size() - 1));
+    osrInsts.push_back(BcInstruction(BcOp::Return, nullopt));
+    // the vm needs the labels if a guard in the region deoptimizes
+    map<int, int> labels;
+    for (int i = 0; i < osrInsts.size(); i++) {
+        if (osrInsts[i].operation == BcOp::Label) {
+            labels[osrInsts[i].operand0.value()] = i + 1;
+        }
+    }
+    // globals live in their cells, so no locals are needed
+    vector<string> noLocals;
+    Function* osrFunc = new Function(func->functions_, constants, 0, noLocals,
+            func->local_reference_vars_, func->free_vars_, func->names_,
+            labels, osrInsts);
+    loadFunction(osrFunc);
+    // carry over the feedback gathered for the loop so far
+    osrFunc->typeFeedback.resize(osrInsts.size(), 0);
+    for (int i = startIndex; i <= exitIndex && i < func->typeFeedback.size(); i++) {
+        osrFunc->typeFeedback[i - startIndex + 1] = func->typeFeedback[i];
+    }
+    for (auto& target : func->callTargets) {
+        if (target.first >= startIndex && target.first <= exitIndex) {
+            osrFunc->callTargets[target.first - startIndex + 1] = target.second;
+        }
+    }
+    return osrFunc;
+}
+
+tagptr_t Interpreter::deoptimize(DeoptPoint* point, tagptr_t* values, tagptr_t* refs) {
+    // a speculative guard failed in compiled code; values holds the function's
+    // locals followed by its operand stack and its captured locals' refs at
+    // point. rebuild the vm frame from these and finish the call in the vm
+    Function* func = point->func;
+    // the next call recompiles using the feedback the vm records from here on
+    discardCode(func);
+    Frame* frame = &pushFrame(func, stackTop());
+    int numLocals = func->local_vars_.size();
+    int numLocalRefs = func->local_reference_vars_.size();
+    // the captured locals' refs follow the stack, NULL_PTR for the ones no
+    // closure has captured yet
+    tagptr_t* localRefs = values + numLocals + point->stack.size();
+    for (int i = 0; i < numLocals; i++) {
+        int ref = func->local_ref_slots_[i];
+        if (ref < 0) {
+            valueStack[frame->base + i] = values[i];
+            continue;
+        }
+        tagptr_t cell = *localRefs++;
+        if (cell == NULL_PTR) {
+            cell = make_ptr(collector->allocate<ValWrapper>(values[i]));
+        }
+        valueStack[frame->base + i] = NONE;
+        frame->ref(ref) = cell;
+    }
+    for (int i = 0; i < func->free_vars_.size(); i++) {
+        frame->ref(numLocalRefs + i) = refs[i];
+    }
+    for (int i = 0; i < point->stack.size(); i++) {
+        frame->opStackPush(values[numLocals + i]);
+    }
+    frame->pc = &func->code_[func->code_index_[point->bcIndex]];
+    // run until the frame returns, which pushes the result onto its caller's
+    // operand stack
+    execute(frames.size() - 1);
+    return frames.back().opStackPop();
+}
+
+void Interpreter::collect() {
+    if (nativeDepth == 0) {
+        collector->gc();
+    } else {
+        collector->gc(nativeStackTop);
+    }
+}
+
+void Interpreter::discardCode(Function* func) {
+    if (func->mcf != nullptr) {
+        retiredCode.push_back(func->mcf);
+        func->mcf = nullptr;
+    }
+}
+
+void Interpreter::freeRetiredCode() {
+    if (nativeDepth > 0) {
+        return;
+    }
+    for (MachineCodeFunction* mcf : retiredCode) {
+        for (DeoptPoint* point : codeDeoptPoints[mcf]) {
+            delete point;
+        }
+        codeDeoptPoints.erase(mcf);
+        delete mcf;
+    }
+    retiredCode.clear();
+}
+
+void Interpreter::storeGlobal(int slot, tagptr_t val) {
+    ValWrapper* cell = globalCells[slot];
+    if (watchedGlobals[slot] && cell->ptr != val) {
+        // only the top level stores these, so none of this code is running.
+        // it's retired all the same, so its deopt points go with it
+        for (Function* func : globalDependents[slot]) {
+            discardCode(func);
+        }
+        globalDependents.erase(slot);
+        watchedGlobals[slot] = 0;
+        unstableGlobals.insert(slot);
+    }
+    cell->ptr = val;
 };
 
-tagptr_t Interpreter::loadGlobal(string name) {
-    return globalFrame->getLocalVar(name);
+tagptr_t Interpreter::globalValue(const string& name) {
+    auto it = globalSlots.find(name);
+    return it == globalSlots.end() ? NULL_PTR : globalCells[it->second]->ptr;
+}
+
+tagptr_t Interpreter::loadGlobal(int slot) {
+    tagptr_t val = globalCells[slot]->ptr;
+    if (val == NULL_PTR) {
+        throw UninitializedVariableException(globalNames[slot] + " is not defined");
+    }
+    return val;
 };
@@ -15,36 +15,127 @@
 #include "../asm/ir_to_asm.h"
 #include "../opt/opt.h"
 #include "../opt/opt_reg_alloc.h"
-#include <list>
+#include "../opt/opt_cfg.h"
+#include "../opt/opt_sccp.h"
+#include "../opt/opt_box.h"
+#include "../opt/opt_licm.h"
+#include "../opt/opt_gvn.h"
+#include "../opt/opt_induction.h"
+#include "../opt/opt_escape.h"
+#include "../opt/opt_global.h"
+#include "../opt/opt_inline.h"
+#include <deque>
 #include <iostream>
 
+// number of vm instructions a top-level loop runs for (counting instructions
+// in functions it calls) before it is compiled and entered through on-stack
+// replacement. top-level loops often run only a few iterations, each of which
+// does a lot of work, so counting back-edges alone would rarely trigger
+#define OSR_THRESHOLD 10000
+
 using namespace std;
 
+struct OsrEntry {
+    // the loop region, entered at the body of the loop whose back-edge
+    // triggered compilation, owned by the entry. its mcf is recompiled if
+    // it was thrown away
+    unique_ptr<Function> func;
+    // index of the EndWhile closing the region; the vm resumes right after it
+    int exitIndex;
+};
+
 class Interpreter {
     // class used to handle interpreter state
 private:
     Frame* globalFrame;  // root function frame
-    list<Frame*> frames;  // stack of frames
-    void executeStep();  // execute a single next instruction
+    CallEffects* callEffects;  // what calls can change, for the optimizer
+    deque<Frame> frames;  // stack of frames
+    vector<tagptr_t> valueStack;  // the frames' locals, refs and operands
+    // pushes a frame for func whose locals start at base, with room for its
+    // values; nothing but the stack's size is set up
+    Frame& pushFrame(Function* func, size_t base);
+    size_t stackTop();
+    void reserveStack(size_t size);
+    // runs the top frame until the frame stack is down to depth frames
+    void execute(size_t depth);
     bool finished;  // true when the program has terminated
     bool shouldCallAsm;
+    bool shouldOsr;
+    int nativeDepth;  // number of compiled functions currently on the stack
+    const void* nativeStackTop;  // frame the outermost of them was called from
+    void checkArgCount(int numArgs, Closure* clos);
+    long stepCount;  // number of instructions executed by the vm
+    map<int, long> loopStartSteps;  // step count when a back-edge was first taken
+    map<int, OsrEntry> osrEntries;  // both keyed by the index of the If instruction
+
+    // helpers for on-stack replacement of loops in the main function
+    bool tryOsr(Frame* frame, int backEdgeIndex);
+    Function* buildOsrFunction(Function* func, int backEdgeIndex, int& exitIndex);
+
+    // compiled code a deopt throws away is still running further up the
+    // stack, so it's only freed, along with the deopt points its guards
+    // resume at, once no compiled code is
+    vector<MachineCodeFunction*> retiredCode;
+    map<MachineCodeFunction*, vector<DeoptPoint*>> codeDeoptPoints;
+    void discardCode(Function* func);
+    void freeRetiredCode();
 
  public:
     // static None
     tagptr_t NONE;
 
     CollectedHeap* collector;
-    Interpreter(Function* mainFunc, int maxmem, bool callAsm);
+    // collects if the heap is due, treating compiled code's frames as
+    // roots when there are any on the stack
+    void collect();
+    Interpreter(Function* mainFunc, int maxmem, bool callAsm, bool useOsr);
     void run();  // executes all instructions until termination
 
     // handle different call methods for vm vs asm exeuction
-    tagptr_t call(vector<tagptr_t> argsList, tagptr_t clos_ptr);
-    // handles calling from the vm
-    tagptr_t callVM(vector<tagptr_t> argsList, tagptr_t clos_ptr);
+    // args points at numArgs values the caller keeps alive for the call
+    tagptr_t call(int numArgs, tagptr_t* args, tagptr_t clos_ptr);
+    // handles calling from the vm, with the closure and its args on top of
+    // the caller's operand stack
+    void callVM(Frame* caller, Closure* clos, int numArgs);
     // handles calling from asm
-    tagptr_t callAsm(vector<tagptr_t> argsList, tagptr_t clos_ptr);
+    tagptr_t callAsm(tagptr_t* args, tagptr_t clos_ptr);
+    // evaluates a native function without touching the vm's frame stack
+    tagptr_t callNative(int numArgs, tagptr_t* args, tagptr_t clos_ptr);
+    // push a frame for calling a closure, with the given args or with the
+    // args already on the value stack where its locals start
+    Frame& makeFrame(int numArgs, tagptr_t* args, Closure* clos);
+    Frame& makeFrame(Closure* clos, size_t base, int numArgs);
+    // compiles a bytecode function down to machine code
+    MachineCodeFunction* compile(Function* func);
+
+    // every global's cell, by slot, kept alive by the global frame's refs.
+    // they are made when the program is loaded so that names are only
+    // looked up to resolve slots and report errors. compiled code
+    // points at the cells and the watched flags, so neither grows after
+    vector<ValWrapper*> globalCells;
+    vector<string> globalNames;
+    map<string, int> globalSlots;
+    int globalSlot(string name);
+    // a global's value, NULL_PTR if it isn't defined
+    tagptr_t globalValue(const string& name);
+    // gets func and the functions inside it ready to run: fills in their
+    // global_slots_, local_ref_slots_ and max_stack_, and decodes their
+    // instructions into code_
+    void loadProgram(Function* func);
+    void loadFunction(Function* func);
+    void decode(Function* func);
+    static int maxStackDepth(Function* func);
+
+    // globals compiled code reads as constants, and the functions that
+    // read them; storing a different value throws their code away, and
+    // makes the global unstable, so it's loaded normally from then on.
+    // stores to watched globals have to go through storeGlobal
+    map<int, set<Function*>> globalDependents;
+    set<int> unstableGlobals;
+    vector<uint8_t> watchedGlobals;
 
     // asm helpers
-    void storeGlobal(string name, tagptr_t val);
-    tagptr_t loadGlobal(string name);
+    tagptr_t deoptimize(DeoptPoint* point, tagptr_t* values, tagptr_t* refs);
+    void storeGlobal(int slot, tagptr_t val);
+    tagptr_t loadGlobal(int slot);
 };